@@ -0,0 +1,407 @@
+// librandomstr 基准测试：遍历字符集、字符串长度、数量、输出目标与随机数引擎，
+// 每个组合重复多次取最快一次，以 CSV（默认）或 JSON Lines 输出，便于在不同
+// 版本之间比对回归。硬件引擎（rdrand、rdseed）只在 CPU 支持时参与对比。仅支持
+// POSIX 平台（管道与临时文件）。
+//
+// --weighted 改为比较带权采样的两种做法：Vose 别名表与前缀和二分查找，分别
+// 报告建表耗时与每次采样耗时。
+//
+// 用法: ./randomstr_bench [--quick] [--json] [--repeat N] [--threads N]
+//                         [--weighted]
+#include "randomstr.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace randomstr;
+
+namespace {
+
+struct BenchCharset {
+  std::string name;
+  Charset charset;
+};
+
+struct Sink {
+  std::string name;
+  int fd = -1;
+  bool truncate = false; // 文件目标每轮从头写，避免测到文件增长
+};
+
+struct Result {
+  double seconds = 0;
+  uint64_t output_bytes = 0;
+  uint64_t write_calls = 0;
+  uint64_t entropy_syscalls = 0;
+};
+
+struct Options {
+  bool quick = false;
+  bool json = false;
+  bool weighted = false;
+  unsigned repeat = 3;
+  unsigned max_threads = 0; // 0 表示 hardware_concurrency
+};
+
+[[noreturn]] void fail(const std::string &message) {
+  std::cerr << "错误: " << message << "\n";
+  std::exit(1);
+}
+
+// 混合大字符集：内置字符集之外再加 2 字节（希腊、西里尔）与 4 字节（emoji）
+// 字符，得到不等宽字符集，走偏移数组寻址的通用路径
+std::string write_mixed_charset_file() {
+  char path[] = "/tmp/randomstr_bench_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    fail("无法创建临时字符集文件");
+  }
+  std::string text;
+  for (uint32_t cp = 0x391; cp <= 0x3C9; ++cp) { // 希腊字母
+    text += static_cast<char>(0xC0 | (cp >> 6));
+    text += static_cast<char>(0x80 | (cp & 0x3F));
+  }
+  for (uint32_t cp = 0x410; cp <= 0x44F; ++cp) { // 西里尔字母
+    text += static_cast<char>(0xC0 | (cp >> 6));
+    text += static_cast<char>(0x80 | (cp & 0x3F));
+  }
+  for (uint32_t cp = 0x1F600; cp <= 0x1F64F; ++cp) { // emoji
+    text += static_cast<char>(0xF0 | (cp >> 18));
+    text += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    text += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    text += static_cast<char>(0x80 | (cp & 0x3F));
+  }
+  OutputWriter out(fd);
+  out.append(text);
+  out.flush();
+  close(fd);
+  return path;
+}
+
+template <typename MakeGenerator>
+Result run_once(MakeGenerator make_generator, const Charset &charset,
+                size_t length, uint64_t count, unsigned threads,
+                const Sink &sink) {
+  if (sink.truncate) {
+    if (ftruncate(sink.fd, 0) != 0 || lseek(sink.fd, 0, SEEK_SET) != 0) {
+      fail("无法截断输出文件");
+    }
+  }
+  OutputWriter out(sink.fd);
+  uint64_t syscalls_before = SystemRandomGenerator::syscall_count();
+  auto start = std::chrono::steady_clock::now();
+  run_generation(make_generator, charset, length, count, 1, threads, out);
+  Result result;
+  result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  result.output_bytes = out.bytes_written();
+  result.write_calls = out.write_calls();
+  result.entropy_syscalls =
+      SystemRandomGenerator::syscall_count() - syscalls_before;
+  return result;
+}
+
+template <typename MakeGenerator>
+Result run_best(MakeGenerator make_generator, const Charset &charset,
+                size_t length, uint64_t count, unsigned threads,
+                const Sink &sink, unsigned repeat) {
+  // 先跑一轮预热（页缓存、CPU 频率、内核选择），不计入结果
+  run_once(make_generator, charset, length, count, threads, sink);
+  Result best;
+  for (unsigned i = 0; i < repeat; ++i) {
+    Result r = run_once(make_generator, charset, length, count, threads, sink);
+    if (i == 0 || r.seconds < best.seconds) {
+      best = r;
+    }
+  }
+  return best;
+}
+
+void print_header(const Options &options) {
+  if (!options.json) {
+    std::printf("charset,charset_size,path,engine,threads,sink,length,count,"
+                "seconds,tokens_per_s,mb_per_s,ns_per_char,"
+                "entropy_syscalls_per_mb,write_calls,output_bytes\n");
+  }
+}
+
+void print_result(const Options &options, const BenchCharset &charset,
+                  const char *path, const char *engine, unsigned threads,
+                  const Sink &sink, size_t length, uint64_t count,
+                  const Result &r) {
+  double mb = r.output_bytes / 1024.0 / 1024.0;
+  double seconds = r.seconds > 0 ? r.seconds : 1e-9;
+  double chars = static_cast<double>(count) * length;
+  double tokens_per_s = count / seconds;
+  double mb_per_s = mb / seconds;
+  double ns_per_char = chars > 0 ? seconds * 1e9 / chars : 0;
+  double syscalls_per_mb = mb > 0 ? r.entropy_syscalls / mb : 0;
+  if (options.json) {
+    std::printf("{\"charset\":\"%s\",\"charset_size\":%zu,\"path\":\"%s\","
+                "\"engine\":\"%s\",\"threads\":%u,\"sink\":\"%s\","
+                "\"length\":%zu,\"count\":%llu,\"seconds\":%.6f,"
+                "\"tokens_per_s\":%.1f,\"mb_per_s\":%.2f,\"ns_per_char\":%.3f,"
+                "\"entropy_syscalls_per_mb\":%.2f,\"write_calls\":%llu,"
+                "\"output_bytes\":%llu}\n",
+                charset.name.c_str(), charset.charset.size(), path, engine,
+                threads, sink.name.c_str(), length,
+                static_cast<unsigned long long>(count), r.seconds,
+                tokens_per_s, mb_per_s, ns_per_char, syscalls_per_mb,
+                static_cast<unsigned long long>(r.write_calls),
+                static_cast<unsigned long long>(r.output_bytes));
+  } else {
+    std::printf("%s,%zu,%s,%s,%u,%s,%zu,%llu,%.6f,%.1f,%.2f,%.3f,%.2f,%llu,"
+                "%llu\n",
+                charset.name.c_str(), charset.charset.size(), path, engine,
+                threads, sink.name.c_str(), length,
+                static_cast<unsigned long long>(count), r.seconds,
+                tokens_per_s, mb_per_s, ns_per_char, syscalls_per_mb,
+                static_cast<unsigned long long>(r.write_calls),
+                static_cast<unsigned long long>(r.output_bytes));
+  }
+  std::fflush(stdout);
+}
+
+Options parse_options(int argc, char *argv[]) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--quick") {
+      options.quick = true;
+    } else if (arg == "--json") {
+      options.json = true;
+    } else if (arg == "--weighted") {
+      options.weighted = true;
+    } else if ((arg == "--repeat" || arg == "--threads") && i + 1 < argc) {
+      unsigned value = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+      (arg == "--repeat" ? options.repeat : options.max_threads) = value;
+    } else {
+      fail("未知参数: " + arg +
+           "（可用: --quick --json --repeat N --threads N --weighted）");
+    }
+  }
+  options.repeat = std::max(1u, options.repeat);
+  if (options.max_threads == 0) {
+    options.max_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  return options;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+void print_weighted_result(const Options &options, const char *method,
+                           size_t symbols, double build_seconds,
+                           double sample_seconds, uint64_t samples,
+                           uint64_t checksum) {
+  double ns_per_sample = sample_seconds * 1e9 / samples;
+  if (options.json) {
+    std::printf("{\"method\":\"%s\",\"symbols\":%zu,\"build_us\":%.1f,"
+                "\"ns_per_sample\":%.3f,\"checksum\":%llu}\n",
+                method, symbols, build_seconds * 1e6, ns_per_sample,
+                static_cast<unsigned long long>(checksum));
+  } else {
+    std::printf("%s,%zu,%.1f,%.3f,%llu\n", method, symbols,
+                build_seconds * 1e6, ns_per_sample,
+                static_cast<unsigned long long>(checksum));
+  }
+  std::fflush(stdout);
+}
+
+// 带权采样：Zipf 权重（第 i 个符号权重约为 1/(i+1)），两种方法使用同一个
+// 引擎与同样无偏的 IndexSampler 抽取列号和硬币，只比较查表部分。checksum
+// 防止采样循环被优化掉。
+void run_weighted(const Options &options) {
+  std::vector<size_t> sizes = {16, 256, 4096, 65536, 1 << 20};
+  uint64_t samples = 10000000;
+  if (options.quick) {
+    sizes = {16, 4096};
+    samples = 1000000;
+  }
+  if (!options.json) {
+    std::printf("method,symbols,build_us,ns_per_sample,checksum\n");
+  }
+  for (size_t n : sizes) {
+    std::vector<uint64_t> weights(n);
+    for (size_t i = 0; i < n; ++i) {
+      weights[i] = 1000000 / (i + 1) + 1;
+    }
+
+    double best_build = 0, best_sample = 0;
+    uint64_t checksum = 0;
+    for (unsigned r = 0; r < options.repeat; ++r) {
+      auto start = std::chrono::steady_clock::now();
+      AliasTable table(weights);
+      double build = seconds_since(start);
+
+      ChaCha20Generator generator;
+      IndexSampler column(n);
+      IndexSampler coin(table.total());
+      checksum = 0;
+      start = std::chrono::steady_clock::now();
+      for (uint64_t i = 0; i < samples; ++i) {
+        checksum += table.pick(column.next(generator), coin.next(generator));
+      }
+      double sample = seconds_since(start);
+      best_build = r == 0 ? build : std::min(best_build, build);
+      best_sample = r == 0 ? sample : std::min(best_sample, sample);
+    }
+    print_weighted_result(options, "alias", n, best_build, best_sample,
+                          samples, checksum);
+
+    for (unsigned r = 0; r < options.repeat; ++r) {
+      auto start = std::chrono::steady_clock::now();
+      std::vector<uint64_t> cumulative(n);
+      uint64_t total = 0;
+      for (size_t i = 0; i < n; ++i) {
+        total += weights[i];
+        cumulative[i] = total;
+      }
+      double build = seconds_since(start);
+
+      ChaCha20Generator generator;
+      IndexSampler coin(total);
+      checksum = 0;
+      start = std::chrono::steady_clock::now();
+      for (uint64_t i = 0; i < samples; ++i) {
+        uint64_t u = coin.next(generator);
+        checksum += static_cast<uint64_t>(
+            std::upper_bound(cumulative.begin(), cumulative.end(), u) -
+            cumulative.begin());
+      }
+      double sample = seconds_since(start);
+      best_build = r == 0 ? build : std::min(best_build, build);
+      best_sample = r == 0 ? sample : std::min(best_sample, sample);
+    }
+    print_weighted_result(options, "binary-search", n, best_build,
+                          best_sample, samples, checksum);
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  Options options = parse_options(argc, argv);
+  if (options.weighted) {
+    run_weighted(options);
+    return 0;
+  }
+  std::signal(SIGPIPE, SIG_IGN);
+
+  std::string mixed_path = write_mixed_charset_file();
+  std::vector<BenchCharset> charsets;
+  charsets.push_back({"dn", build_charset("", {"dn"})});
+  charsets.push_back({"en", build_charset("", {"en"})});
+  charsets.push_back({"zh", build_charset("", {"zh"})});
+  charsets.push_back({"sp", build_charset("", {"sp"})});
+  charsets.push_back({"mixed", build_charset("", {"dn", "en", "zh", "sp",
+                                                  mixed_path})});
+  unlink(mixed_path.c_str());
+
+  // 输出目标：/dev/null、由后台线程读空的管道、临时文件
+  std::vector<Sink> sinks;
+  int null_fd = open("/dev/null", O_WRONLY);
+  if (null_fd < 0) {
+    fail("无法打开 /dev/null");
+  }
+  sinks.push_back({"devnull", null_fd, false});
+
+  int pipe_fds[2];
+  if (pipe(pipe_fds) != 0) {
+    fail("无法创建管道");
+  }
+  std::thread drain([read_fd = pipe_fds[0]] {
+    std::vector<char> buffer(1 << 20);
+    while (read(read_fd, buffer.data(), buffer.size()) > 0) {
+    }
+  });
+  sinks.push_back({"pipe", pipe_fds[1], false});
+
+  char file_path[] = "/tmp/randomstr_bench_out_XXXXXX";
+  int file_fd = mkstemp(file_path);
+  if (file_fd < 0) {
+    fail("无法创建临时输出文件");
+  }
+  unlink(file_path);
+  sinks.push_back({"file", file_fd, true});
+
+  std::vector<size_t> lengths = {8, 32, 128};
+  std::vector<uint64_t> counts = {1, 1000, 100000};
+  if (options.quick) {
+    lengths = {16};
+    counts = {1000, 20000};
+  }
+  // 线程数按 1、2、4……翻倍直到 --threads，观察吞吐量随线程数的扩展
+  std::vector<unsigned> thread_counts;
+  for (unsigned threads = 1; threads < options.max_threads; threads *= 2) {
+    thread_counts.push_back(threads);
+  }
+  thread_counts.push_back(options.max_threads);
+
+  print_header(options);
+  for (const auto &charset : charsets) {
+    const char *path = CharsetSampler(charset.charset).path_name();
+    for (size_t length : lengths) {
+      for (uint64_t count : counts) {
+        for (const auto &sink : sinks) {
+          for (unsigned threads : thread_counts) {
+            if (threads > 1 && count < 1000) {
+              continue; // 单个字符串无法并行
+            }
+            Result system = run_best(
+                [] { return SystemRandomGenerator(); }, charset.charset,
+                length, count, threads, sink, options.repeat);
+            print_result(options, charset, path, "system", threads, sink,
+                         length, count, system);
+            Result chacha = run_best([] { return ChaCha20Generator(); },
+                                     charset.charset, length, count, threads,
+                                     sink, options.repeat);
+            print_result(options, charset, path, "chacha20", threads, sink,
+                         length, count, chacha);
+            Result seeded = run_best([] { return Xoshiro256Generator(1); },
+                                     charset.charset, length, count, threads,
+                                     sink, options.repeat);
+            print_result(options, charset, path, "xoshiro256**", threads,
+                         sink, length, count, seeded);
+            // 硬件指令不可用时引擎会回退到 getrandom，不计入对比
+            for (HardwareInstruction instruction :
+                 {HardwareInstruction::rdrand, HardwareInstruction::rdseed}) {
+              if (hardware_random_unavailable(instruction) != nullptr) {
+                continue;
+              }
+              Result hardware = run_best(
+                  [instruction] { return HardwareRandomGenerator(instruction); },
+                  charset.charset, length, count, threads, sink,
+                  options.repeat);
+              print_result(options, charset, path,
+                           instruction == HardwareInstruction::rdrand
+                               ? "rdrand"
+                               : "rdseed",
+                           threads, sink, length, count, hardware);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  close(pipe_fds[1]);
+  drain.join();
+  close(pipe_fds[0]);
+  close(null_fd);
+  close(file_fd);
+  return 0;
+}
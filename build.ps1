@@ -3,7 +3,7 @@ $OutputEncoding = [System.Text.Encoding]::UTF8
 [Console]::OutputEncoding = [System.Text.Encoding]::UTF8
 $ErrorActionPreference = "Stop"
 
-Write-Host "正在编译 str_random.cc ..." -ForegroundColor Cyan
+Write-Host "正在编译 str_random.cc randomstr.cc charset_file.cc pattern.cc unique.cc policy.cc jobs.cc selftest.cc token_server.cc ..." -ForegroundColor Cyan
 
 # 检查是否是 Windows 环境
 $isWin = $IsWindows -or $env:OS -eq "Windows_NT"
@@ -11,8 +11,8 @@ $isWin = $IsWindows -or $env:OS -eq "Windows_NT"
 # 执行编译：
 # 核心改动：直接把 -lbcrypt 写在命令行最后，确保链接顺序
 if ($isWin) {
-g++ -std=c++17 -O2 -Wall -s -ffunction-sections -fdata-sections `
-    str_random.cc -o out -lbcrypt "-Wl,--gc-sections"
+g++ -std=c++17 -O2 -Wall -pthread -s -ffunction-sections -fdata-sections `
+    str_random.cc randomstr.cc charset_file.cc pattern.cc unique.cc policy.cc jobs.cc selftest.cc token_server.cc -o out -lbcrypt "-Wl,--gc-sections"
 } 
 
 if ($LASTEXITCODE -eq 0) {
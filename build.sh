@@ -1,7 +1,7 @@
 #!/usr/bin/env bash
 set -euo pipefail
 
-echo "正在编译 str_random.cc ..."
+echo "正在编译 str_random.cc randomstr.cc charset_file.cc pattern.cc unique.cc policy.cc jobs.cc selftest.cc token_server.cc ..."
 
 UNAME=$(uname -s || echo unknown)
 LDFLAGS=""
@@ -11,7 +11,7 @@ if echo "$UNAME" | grep -qiE "mingw|msys|cygwin"; then
     LDFLAGS+=" -lbcrypt"
 fi
 
-g++ -std=c++17 -O2 -Wall -Wextra -Werror -s -I . \
-    str_random.cc -o out $LDFLAGS
+g++ -std=c++17 -O2 -Wall -Wextra -Werror -pthread -s -I . \
+    str_random.cc randomstr.cc charset_file.cc pattern.cc unique.cc policy.cc jobs.cc selftest.cc token_server.cc -o out $LDFLAGS
 
 echo "✓ 编译成功！可执行文件: out"
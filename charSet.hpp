@@ -1,5 +1,8 @@
 #ifndef CHARSET_HPP
 #define CHARSET_HPP
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <string_view>
 constexpr std::string_view digit_nw /*win11中有这个变量名 _nw表示no=window */ =
     "0123456789";
@@ -94,7 +97,7 @@ constexpr std::string_view zh =
     "屉居届刷屈弧弥弦"
     "承孟"
     "陋陌孤陕降函限妹姑姐姓妮始姆迢驾叁参艰线练组绅细驶织驹终驻绊驼绍绎经贯契贰"
-    "奏春帮玷珍玲珊󠄁玻"
+    "奏春帮玷珍玲珊玻"
     "毒型"
     "拭挂封持拷拱项垮挎城挟挠政赴赵挡拽哉挺括垢拴拾挑垛指垫挣挤拼挖按挥挪拯某甚"
     "荆茸革茬荐巷带草"
@@ -235,4 +238,136 @@ constexpr std::string_view zh =
 
 constexpr std::string_view special = "!@#$%^&*()_+-=[]{}|;':\",./<>?`~";
 constexpr std::string_view unviewable = "	";
+
+// ---------------------------------------------------------------------------
+// 编译期预处理的内置字符集
+// ---------------------------------------------------------------------------
+
+// 单个字符的 UTF-8 字节打包进 64 位整数：高位起依次为各字节，最低字节为字节
+// 数。整数顺序与按字节比较 std::string 的顺序一致，排序去重只需比较整数。
+using PackedChar = uint64_t;
+
+constexpr size_t packed_char_length(PackedChar c) {
+  return static_cast<size_t>(c & 0xFF);
+}
+
+// 与清理字符集时的 std::isspace 一致（C locale）
+constexpr bool is_charset_space(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// 根据 UTF-8 首字节判断字符长度，非法首字节按单字节处理
+constexpr size_t utf8_char_length(unsigned char c) {
+  if ((c & 0xE0) == 0xC0)
+    return 2;
+  if ((c & 0xF0) == 0xE0)
+    return 3;
+  if ((c & 0xF8) == 0xF0)
+    return 4;
+  return 1;
+}
+
+// 去除空白后按 UTF-8 切分 s，对每个字符调用 f(PackedChar)。规则与
+// split_utf8_string 相同：剩余字节不足时按单字节处理。
+template <typename F>
+constexpr void for_each_packed_char(std::string_view s, F &&f) {
+  size_t remaining = 0;
+  for (size_t i = 0; i < s.size(); ++i) {
+    remaining += is_charset_space(s[i]) ? 0 : 1;
+  }
+  size_t i = 0;
+  while (remaining > 0) {
+    while (is_charset_space(s[i])) {
+      ++i;
+    }
+    size_t n = utf8_char_length(static_cast<unsigned char>(s[i]));
+    if (n > remaining) {
+      n = 1;
+    }
+    PackedChar packed = n;
+    for (size_t k = 0; k < n; ++i) {
+      if (!is_charset_space(s[i])) {
+        packed |= PackedChar{static_cast<unsigned char>(s[i])} << (56 - 8 * k);
+        ++k;
+      }
+    }
+    f(packed);
+    remaining -= n;
+  }
+}
+
+constexpr size_t packed_char_count(std::string_view s) {
+  size_t count = 0;
+  for_each_packed_char(s, [&count](PackedChar) { ++count; });
+  return count;
+}
+
+// 已排序、去重的字符表；chars 中前 size 个有效
+template <size_t N> struct PackedCharset {
+  std::array<PackedChar, N> chars{};
+  size_t size = 0;
+};
+
+template <size_t N>
+constexpr PackedCharset<N> make_packed_charset(std::string_view s) {
+  PackedCharset<N> table;
+  size_t n = 0;
+  for_each_packed_char(s, [&](PackedChar c) { table.chars[n++] = c; });
+  // 堆排序（C++17 的 std::sort 不能在编译期使用）
+  auto sift_down = [&table](size_t root, size_t end) {
+    while (2 * root + 1 < end) {
+      size_t child = 2 * root + 1;
+      if (child + 1 < end && table.chars[child] < table.chars[child + 1]) {
+        ++child;
+      }
+      if (!(table.chars[root] < table.chars[child])) {
+        return;
+      }
+      PackedChar tmp = table.chars[root];
+      table.chars[root] = table.chars[child];
+      table.chars[child] = tmp;
+      root = child;
+    }
+  };
+  for (size_t i = n / 2; i-- > 0;) {
+    sift_down(i, n);
+  }
+  for (size_t end = n; end-- > 1;) {
+    PackedChar tmp = table.chars[0];
+    table.chars[0] = table.chars[end];
+    table.chars[end] = tmp;
+    sift_down(0, end);
+  }
+  for (size_t i = 0; i < n; ++i) {
+    if (table.size == 0 || table.chars[table.size - 1] != table.chars[i]) {
+      table.chars[table.size++] = table.chars[i];
+    }
+  }
+  return table;
+}
+
+#define CHARSET_PACKED_TABLE(name, text)                                       \
+  inline constexpr auto name =                                                 \
+      make_packed_charset<packed_char_count(text)>(text)
+
+CHARSET_PACKED_TABLE(digit_table, digit_nw);
+CHARSET_PACKED_TABLE(en_table, en_nw);
+CHARSET_PACKED_TABLE(zh_table, zh);
+CHARSET_PACKED_TABLE(special_table, special);
+
+#undef CHARSET_PACKED_TABLE
+
+// -s 可用的内置字符集
+struct BuiltinCharset {
+  std::string_view name;
+  const PackedChar *chars;
+  size_t size;
+};
+
+inline constexpr BuiltinCharset builtin_charsets[] = {
+    {"dn", digit_table.chars.data(), digit_table.size},
+    {"en", en_table.chars.data(), en_table.size},
+    {"zh", zh_table.chars.data(), zh_table.size},
+    {"sp", special_table.chars.data(), special_table.size},
+};
 #endif // CHARSET_HPP
@@ -0,0 +1,507 @@
+// 字符集文件加载：映射文件、向量化校验 UTF-8、按码点位图去重，直接产出已排序
+// 的打包字符（可与内置字符集归并），不为每个字符分配字符串
+#include "randomstr.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+
+#include "charSet.hpp"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// x86 上启用 AVX2 校验（运行时检测 CPU 特性）
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STR_RANDOM_X86 1
+#include <immintrin.h>
+#endif
+
+namespace randomstr {
+
+namespace {
+
+constexpr uint32_t MAX_CODE_POINT = 0x10FFFF;
+
+// 只读的文件内容：常规文件直接映射，其余（管道、进程替换等）读入内存
+class FileContents {
+public:
+  // kind 用于错误信息，如 "字符集文件"
+  explicit FileContents(const std::string &path,
+                        const char *kind = "字符集文件") {
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      throw std::runtime_error(std::string("无法打开") + kind + ": " + path);
+    }
+    struct stat st {};
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void *p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                     MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+        mapped_ = static_cast<const char *>(p);
+        size_ = static_cast<size_t>(st.st_size);
+        close(fd);
+        return;
+      }
+    }
+    char chunk[64 * 1024];
+    for (;;) {
+      ssize_t n = read(fd, chunk, sizeof(chunk));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0) {
+        int err = errno;
+        close(fd);
+        throw std::runtime_error(std::string("读取") + kind + "失败: " +
+                                 path + ": " + std::strerror(err));
+      }
+      if (n == 0) {
+        break;
+      }
+      buffer_.append(chunk, static_cast<size_t>(n));
+    }
+    close(fd);
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+      throw std::runtime_error(std::string("无法打开") + kind + ": " + path);
+    }
+    std::stringstream stream;
+    stream << file.rdbuf();
+    buffer_ = stream.str();
+#endif
+    size_ = buffer_.size();
+  }
+
+  ~FileContents() {
+#ifndef _WIN32
+    if (mapped_ != nullptr) {
+      munmap(const_cast<char *>(mapped_), size_);
+    }
+#endif
+  }
+
+  FileContents(const FileContents &) = delete;
+  FileContents &operator=(const FileContents &) = delete;
+
+  const char *data() const { return mapped_ != nullptr ? mapped_ : buffer_.data(); }
+  size_t size() const { return size_; }
+
+private:
+  const char *mapped_ = nullptr;
+  std::string buffer_;
+  size_t size_ = 0;
+};
+
+// 标量校验：返回第一个非法字节的偏移，合法时返回 size。拒绝过长编码、代理
+// 区（U+D800..U+DFFF）、超出 U+10FFFF 以及截断的序列。
+size_t utf8_error_offset(const unsigned char *s, size_t size) {
+  size_t i = 0;
+  while (i < size) {
+    unsigned char c = s[i];
+    if (c < 0x80) {
+      ++i;
+      continue;
+    }
+    size_t n;
+    unsigned char lo = 0x80, hi = 0xBF; // 第二个字节的合法范围
+    if (c >= 0xC2 && c <= 0xDF) {
+      n = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+      n = 3;
+      lo = c == 0xE0 ? 0xA0 : 0x80;
+      hi = c == 0xED ? 0x9F : 0xBF;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+      n = 4;
+      lo = c == 0xF0 ? 0x90 : 0x80;
+      hi = c == 0xF4 ? 0x8F : 0xBF;
+    } else {
+      return i;
+    }
+    if (n > size - i || s[i + 1] < lo || s[i + 1] > hi) {
+      return i;
+    }
+    for (size_t k = 2; k < n; ++k) {
+      if ((s[i + k] & 0xC0) != 0x80) {
+        return i;
+      }
+    }
+    i += n;
+  }
+  return size;
+}
+
+bool utf8_validate_scalar(const char *data, size_t size) {
+  return utf8_error_offset(reinterpret_cast<const unsigned char *>(data),
+                           size) == size;
+}
+
+#ifdef STR_RANDOM_X86
+// Keiser & Lemire 的查表法（"Validating UTF-8 In Less Than One Instruction
+// Per Byte"）：用前一字节的高、低半字节与当前字节的高半字节各查一次 16 项
+// 表，三者按位与后非零即为非法的两字节组合；三、四字节序列的后续字节另用饱和
+// 减法检查。纯 ASCII 块只需检查上一块末尾是否有未完成的序列。
+constexpr uint8_t TOO_SHORT = 1 << 0;
+constexpr uint8_t TOO_LONG = 1 << 1;
+constexpr uint8_t OVERLONG_3 = 1 << 2;
+constexpr uint8_t TOO_LARGE = 1 << 3;
+constexpr uint8_t SURROGATE = 1 << 4;
+constexpr uint8_t OVERLONG_2 = 1 << 5;
+constexpr uint8_t TOO_LARGE_1000 = 1 << 6;
+constexpr uint8_t OVERLONG_4 = 1 << 6;
+constexpr uint8_t TWO_CONTS = 1 << 7;
+constexpr uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+__attribute__((target("avx2"))) inline __m256i
+avx2_lookup16(__m256i index, const uint8_t (&table)[16]) {
+  __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i *>(table));
+  return _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(t), index);
+}
+
+// 把 prev 末尾 N 个字节拼到 input 前面（跨 128 位通道）
+template <int N>
+__attribute__((target("avx2"))) inline __m256i avx2_prev(__m256i input,
+                                                         __m256i prev) {
+  return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21),
+                            16 - N);
+}
+
+__attribute__((target("avx2"))) inline __m256i avx2_high_nibble(__m256i v) {
+  return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+}
+
+__attribute__((target("avx2"))) inline __m256i
+avx2_check_block(__m256i input, __m256i prev_input) {
+  static const uint8_t byte_1_high[16] = {
+      TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+      TOO_LONG, TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+      TOO_SHORT | OVERLONG_2, TOO_SHORT, TOO_SHORT | OVERLONG_3 | SURROGATE,
+      TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4};
+  static const uint8_t byte_1_low[16] = {
+      CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+      CARRY | OVERLONG_2,
+      CARRY,
+      CARRY,
+      CARRY | TOO_LARGE,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000};
+  static const uint8_t byte_2_high[16] = {
+      TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+      TOO_SHORT, TOO_SHORT,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 |
+          OVERLONG_4,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+      TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT};
+
+  __m256i prev1 = avx2_prev<1>(input, prev_input);
+  __m256i special = _mm256_and_si256(
+      _mm256_and_si256(avx2_lookup16(avx2_high_nibble(prev1), byte_1_high),
+                       avx2_lookup16(_mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)),
+                                     byte_1_low)),
+      avx2_lookup16(avx2_high_nibble(input), byte_2_high));
+
+  // 前两个字节是三字节首字节或前三个字节是四字节首字节时，当前字节必须是
+  // 后续字节；special 中 TWO_CONTS (0x80) 位恰好标记了“是后续字节”
+  __m256i prev2 = avx2_prev<2>(input, prev_input);
+  __m256i prev3 = avx2_prev<3>(input, prev_input);
+  __m256i must23 = _mm256_or_si256(
+      _mm256_subs_epu8(prev2, _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80))),
+      _mm256_subs_epu8(prev3, _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80))));
+  __m256i must23_80 = _mm256_and_si256(must23, _mm256_set1_epi8(static_cast<char>(0x80)));
+  return _mm256_xor_si256(must23_80, special);
+}
+
+// 块末尾 3 个字节中是否有需要后续字节的首字节
+__attribute__((target("avx2"))) inline __m256i avx2_incomplete(__m256i input) {
+  const __m256i max_value = _mm256_setr_epi8(
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, static_cast<char>(0xF0 - 1),
+      static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+  return _mm256_subs_epu8(input, max_value);
+}
+
+struct Avx2Utf8State {
+  __m256i error;
+  __m256i prev_input;
+  __m256i prev_incomplete;
+};
+
+__attribute__((target("avx2"))) inline void avx2_step(Avx2Utf8State &state,
+                                                      __m256i input) {
+  if (_mm256_movemask_epi8(input) == 0) {
+    state.error = _mm256_or_si256(state.error, state.prev_incomplete);
+  } else {
+    state.error = _mm256_or_si256(state.error,
+                                  avx2_check_block(input, state.prev_input));
+    state.prev_incomplete = avx2_incomplete(input);
+  }
+  state.prev_input = input;
+}
+
+__attribute__((target("avx2"))) bool utf8_validate_avx2(const char *data,
+                                                        size_t size) {
+  Avx2Utf8State state{_mm256_setzero_si256(), _mm256_setzero_si256(),
+                      _mm256_setzero_si256()};
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    avx2_step(state,
+              _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)));
+  }
+  if (i < size) {
+    // 尾部补零（ASCII），未完成的序列会被判为 TOO_SHORT
+    alignas(32) char tail[32] = {};
+    std::memcpy(tail, data + i, size - i);
+    avx2_step(state, _mm256_load_si256(reinterpret_cast<const __m256i *>(tail)));
+  }
+  __m256i error = _mm256_or_si256(state.error, state.prev_incomplete);
+  return _mm256_testz_si256(error, error) != 0;
+}
+#endif // STR_RANDOM_X86
+
+// 已校验的输入：跳过空白，把每个码点记入位图。返回非空白字符数。
+uint64_t mark_code_points(const unsigned char *s, size_t size,
+                          std::vector<uint64_t> &bitmap, uint32_t &min_cp,
+                          uint32_t &max_cp) {
+  uint64_t chars = 0;
+  size_t i = 0;
+  while (i < size) {
+    unsigned char c = s[i];
+    uint32_t cp;
+    if (c < 0x80) {
+      ++i;
+      if (is_charset_space(static_cast<char>(c))) {
+        continue;
+      }
+      cp = c;
+    } else if (c < 0xE0) {
+      cp = (uint32_t{c} & 0x1F) << 6 | (s[i + 1] & 0x3F);
+      i += 2;
+    } else if (c < 0xF0) {
+      cp = (uint32_t{c} & 0x0F) << 12 | uint32_t{s[i + 1] & 0x3Fu} << 6 |
+           (s[i + 2] & 0x3F);
+      i += 3;
+    } else {
+      cp = (uint32_t{c} & 0x07) << 18 | uint32_t{s[i + 1] & 0x3Fu} << 12 |
+           uint32_t{s[i + 2] & 0x3Fu} << 6 | (s[i + 3] & 0x3F);
+      i += 4;
+    }
+    bitmap[cp >> 6] |= uint64_t{1} << (cp & 63);
+    min_cp = std::min(min_cp, cp);
+    max_cp = std::max(max_cp, cp);
+    ++chars;
+  }
+  return chars;
+}
+
+// 码点编码为打包字符（高位起依次为 UTF-8 各字节，最低字节为字节数）
+PackedChar pack_code_point(uint32_t cp) {
+  if (cp < 0x80) {
+    return PackedChar{cp} << 56 | 1;
+  }
+  if (cp < 0x800) {
+    return PackedChar{0xC0 | cp >> 6} << 56 | PackedChar{0x80 | (cp & 0x3F)} << 48 | 2;
+  }
+  if (cp < 0x10000) {
+    return PackedChar{0xE0 | cp >> 12} << 56 |
+           PackedChar{0x80 | ((cp >> 6) & 0x3F)} << 48 |
+           PackedChar{0x80 | (cp & 0x3F)} << 40 | 3;
+  }
+  return PackedChar{0xF0 | cp >> 18} << 56 |
+         PackedChar{0x80 | ((cp >> 12) & 0x3F)} << 48 |
+         PackedChar{0x80 | ((cp >> 6) & 0x3F)} << 40 |
+         PackedChar{0x80 | (cp & 0x3F)} << 32 | 4;
+}
+
+} // namespace
+
+const Utf8ValidatorInfo &utf8_validator() {
+  static const Utf8ValidatorInfo info = [] {
+#ifdef STR_RANDOM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return Utf8ValidatorInfo{utf8_validate_avx2, "utf8-avx2"};
+    }
+#endif
+    return Utf8ValidatorInfo{utf8_validate_scalar, "utf8-scalar"};
+  }();
+  return info;
+}
+
+std::vector<uint64_t> load_charset_file_packed(const std::string &path,
+                                               CharsetFileInfo *info) {
+  FileContents file(path);
+  const auto *bytes = reinterpret_cast<const unsigned char *>(file.data());
+  if (!utf8_validator().validate(file.data(), file.size())) {
+    throw std::runtime_error("字符集文件不是合法的 UTF-8: " + path + " (字节偏移 " +
+                             std::to_string(utf8_error_offset(bytes, file.size())) +
+                             ")");
+  }
+
+  // UTF-8 的字节序与码点序一致，按码点升序遍历位图得到的打包字符已排序
+  std::vector<uint64_t> bitmap((MAX_CODE_POINT >> 6) + 1);
+  uint32_t min_cp = MAX_CODE_POINT;
+  uint32_t max_cp = 0;
+  uint64_t chars = mark_code_points(bytes, file.size(), bitmap, min_cp, max_cp);
+  if (chars == 0) {
+    throw std::runtime_error("字符集文件为空或只包含空白字符。");
+  }
+
+  size_t unique = 0;
+  for (size_t w = min_cp >> 6; w <= (max_cp >> 6); ++w) {
+    unique += static_cast<size_t>(__builtin_popcountll(bitmap[w]));
+  }
+  std::vector<uint64_t> packed;
+  packed.reserve(unique);
+  for (size_t w = min_cp >> 6; w <= (max_cp >> 6); ++w) {
+    for (uint64_t bits = bitmap[w]; bits != 0; bits &= bits - 1) {
+      packed.push_back(pack_code_point(
+          static_cast<uint32_t>(w << 6 | static_cast<size_t>(__builtin_ctzll(bits)))));
+    }
+  }
+  if (info != nullptr) {
+    info->bytes = file.size();
+    info->chars = chars;
+  }
+  return packed;
+}
+
+Charset load_weighted_charset(const std::string &path) {
+  FileContents file(path);
+  const char *data = file.data();
+  const size_t size = file.size();
+  if (!utf8_validator().validate(data, size)) {
+    throw std::runtime_error(
+        "权重文件不是合法的 UTF-8: " + path + " (字节偏移 " +
+        std::to_string(utf8_error_offset(
+            reinterpret_cast<const unsigned char *>(data), size)) +
+        ")");
+  }
+
+  std::vector<std::pair<PackedChar, uint64_t>> entries;
+  size_t line_no = 0;
+  for (size_t pos = 0; pos < size;) {
+    size_t end = pos;
+    while (end < size && data[end] != '\n') {
+      ++end;
+    }
+    std::string_view line(data + pos, end - pos);
+    pos = end + 1;
+    ++line_no;
+
+    size_t i = 0;
+    while (i < line.size() && is_charset_space(line[i])) {
+      ++i;
+    }
+    if (i == line.size()) {
+      continue; // 空行
+    }
+    const size_t n = utf8_char_length(static_cast<unsigned char>(line[i]));
+    PackedChar packed = n;
+    for (size_t k = 0; k < n; ++k) {
+      packed |= PackedChar{static_cast<unsigned char>(line[i + k])}
+                << (56 - 8 * k);
+    }
+    const bool hash = line[i] == '#';
+    i += n;
+
+    // 字符之后：空白、十进制权重、可选的行尾空白
+    size_t digits_begin = i;
+    while (i < line.size() && is_charset_space(line[i])) {
+      ++i;
+    }
+    bool separated = i > digits_begin;
+    digits_begin = i;
+    uint64_t weight = 0;
+    bool overflow = false;
+    while (i < line.size() && line[i] >= '0' && line[i] <= '9') {
+      overflow = overflow || weight > (UINT64_MAX - 9) / 10;
+      weight = weight * 10 + static_cast<uint64_t>(line[i] - '0');
+      ++i;
+    }
+    bool has_digits = i > digits_begin;
+    while (i < line.size() && is_charset_space(line[i])) {
+      ++i;
+    }
+    if (!separated || !has_digits || i != line.size()) {
+      if (hash) {
+        continue; // 注释行：以 # 开头且不是“# <权重>”
+      }
+      throw std::runtime_error("权重文件格式错误: " + path + " 第 " +
+                               std::to_string(line_no) +
+                               " 行，应为“<字符> <权重>”");
+    }
+    if (overflow || weight > AliasTable::MAX_TOTAL_WEIGHT) {
+      throw std::runtime_error("权重过大: " + path + " 第 " +
+                               std::to_string(line_no) + " 行");
+    }
+    if (weight > 0) {
+      entries.emplace_back(packed, weight);
+    }
+  }
+
+  // 按字符排序，重复出现的字符权重相加
+  std::sort(entries.begin(), entries.end());
+  std::vector<PackedChar> chars;
+  std::vector<uint64_t> weights;
+  for (const auto &[packed, weight] : entries) {
+    if (!chars.empty() && chars.back() == packed) {
+      weights.back() += weight;
+    } else {
+      chars.push_back(packed);
+      weights.push_back(weight);
+    }
+  }
+  if (chars.empty()) {
+    throw std::runtime_error("权重文件中没有权重为正的字符: " + path);
+  }
+
+  Charset charset(chars);
+  try {
+    charset.set_weights(weights);
+  } catch (const std::invalid_argument &e) {
+    throw std::runtime_error(std::string(e.what()) + ": " + path);
+  }
+  return charset;
+}
+
+void for_each_token_in_file(const std::string &path,
+                            const std::function<void(std::string_view)> &f) {
+  FileContents file(path, "令牌文件");
+  const char *p = file.data();
+  const char *end = p + file.size();
+  while (p < end) {
+    while (p < end && is_charset_space(*p)) {
+      ++p;
+    }
+    const char *begin = p;
+    while (p < end && !is_charset_space(*p)) {
+      ++p;
+    }
+    if (p > begin) {
+      f(std::string_view(begin, static_cast<size_t>(p - begin)));
+    }
+  }
+}
+
+} // namespace randomstr
@@ -0,0 +1,335 @@
+// 批量任务（--jobs）：清单解析、字符集缓存与工作窃取调度
+#include "jobs.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+
+namespace randomstr {
+
+namespace {
+
+bool parse_number(const std::string &text, uint64_t &value) {
+  if (text.empty() || text.size() > 19 ||
+      !std::all_of(text.begin(), text.end(),
+                   [](char c) { return c >= '0' && c <= '9'; })) {
+    return false;
+  }
+  value = std::stoull(text);
+  return true;
+}
+
+// 字符集缓存：第一层按路径缓存字符集文件的打包字符（内置字符集在编译期已
+// 打包，无需缓存），第二层按排序去重后的来源组合缓存构建好的 Charset。
+// 构建交给 build_charset，只把文件读取换成第一层缓存，因此结果与单独运行
+// 完全相同。每个条目只构建一次，并发请求同一条目的任务等待构建完成
+class CharsetCache {
+public:
+  explicit CharsetCache(JobRunStats &stats) : stats_(stats) {}
+
+  // 构建失败（所有来源都不可用）时抛出 std::runtime_error
+  const Charset &get(const std::vector<std::string> &sources) {
+    std::set<std::string> unique(sources.begin(), sources.end());
+    std::string key;
+    for (const auto &source : unique) {
+      key += (key.empty() ? "" : "+") + source;
+    }
+
+    CharsetEntry &entry = lookup(charsets_, key);
+    bool built = false;
+    std::call_once(entry.once, [&] {
+      built = true;
+      try {
+        // 无法读取的文件已在第一层记为警告，这里不再重复收集
+        entry.charset = build_charset(
+            "", std::vector<std::string>(unique.begin(), unique.end()),
+            [this](const std::string &path) { return load(path); });
+      } catch (const std::runtime_error &e) {
+        entry.error = e.what();
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++stats_.charsets_built;
+    });
+    if (!built) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++stats_.charset_cache_hits;
+    }
+    if (!entry.error.empty()) {
+      throw std::runtime_error(entry.error);
+    }
+    return entry.charset;
+  }
+
+private:
+  struct FileEntry {
+    std::once_flag once;
+    std::vector<uint64_t> chars;
+    std::string error; // 为空表示读取成功
+  };
+  struct CharsetEntry {
+    std::once_flag once;
+    Charset charset;
+    std::string error;
+  };
+
+  JobRunStats &stats_;
+  std::mutex mutex_; // 保护两张表的结构与 stats_
+  std::map<std::string, std::unique_ptr<FileEntry>> files_;
+  std::map<std::string, std::unique_ptr<CharsetEntry>> charsets_;
+
+  template <typename Entry>
+  Entry &lookup(std::map<std::string, std::unique_ptr<Entry>> &table,
+                const std::string &key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &slot = table[key];
+    if (!slot) {
+      slot = std::make_unique<Entry>();
+    }
+    return *slot;
+  }
+
+  // build_charset 的文件加载器：每个路径只读取一次，失败的原因只记一次
+  std::vector<uint64_t> load(const std::string &path) {
+    FileEntry &entry = lookup(files_, path);
+    std::call_once(entry.once, [&] {
+      try {
+        entry.chars = load_charset_file_packed(path);
+      } catch (const std::exception &e) {
+        entry.error = e.what();
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++stats_.files_loaded;
+      if (!entry.error.empty()) {
+        stats_.warnings.push_back(entry.error);
+      }
+    });
+    if (!entry.error.empty()) {
+      throw std::runtime_error(entry.error);
+    }
+    return entry.chars;
+  }
+};
+
+// 工作窃取调度：任务按估算输出从大到小轮流分到各线程的双端队列；线程从
+// 自己队列的头部取任务（先做大的），队列空了就从其他线程队列的尾部窃取
+// （偷小的，减少与队主的争用）。任务都是整块文件，粒度粗，每个队列一把锁
+class WorkStealingQueues {
+public:
+  WorkStealingQueues(unsigned workers, const std::vector<size_t> &order)
+      : queues_(workers) {
+    for (size_t i = 0; i < order.size(); ++i) {
+      queues_[i % workers].tasks.push_back(order[i]);
+    }
+  }
+
+  // 取下一个任务；全部做完时返回 false
+  bool next(unsigned worker, size_t &task) {
+    if (pop(queues_[worker], task, true)) {
+      return true;
+    }
+    for (size_t k = 1; k < queues_.size(); ++k) {
+      if (pop(queues_[(worker + k) % queues_.size()], task, false)) {
+        steals_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+    return false; // 任务不会新增，所有队列都空即结束
+  }
+
+  uint64_t steals() const { return steals_.load(std::memory_order_relaxed); }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<size_t> tasks;
+  };
+  std::vector<Queue> queues_;
+  std::atomic<uint64_t> steals_{0};
+
+  static bool pop(Queue &queue, size_t &task, bool front) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+      return false;
+    }
+    if (front) {
+      task = queue.tasks.front();
+      queue.tasks.pop_front();
+    } else {
+      task = queue.tasks.back();
+      queue.tasks.pop_back();
+    }
+    return true;
+  }
+};
+
+template <typename Fn> void with_engine(const JobOptions &options, Fn &&fn) {
+  if (options.seeded) {
+    fn([&] { return Xoshiro256Generator(options.seed); });
+  } else if (options.engine == EngineKind::chacha20) {
+    fn([&] { return ChaCha20Generator(options.reseed_interval); });
+  } else if (options.engine == EngineKind::rdrand ||
+             options.engine == EngineKind::rdseed) {
+    fn([&] {
+      return HardwareRandomGenerator(options.engine == EngineKind::rdrand
+                                         ? HardwareInstruction::rdrand
+                                         : HardwareInstruction::rdseed,
+                                     options.mix_kernel, options.pool_size);
+    });
+  } else {
+    fn([&] { return SystemRandomGenerator(options.pool_size); });
+  }
+}
+
+// 单个任务：与 main 的单线程路径相同，定长令牌映射文件原地填充，否则经
+// OutputWriter 大块写出
+template <typename Source>
+uint64_t write_job(const Source &source, const JobSpec &job,
+                   const JobOptions &options, const OutputLayout &layout) {
+  int fd = open_output_file(job.output);
+  uint64_t written = 0;
+  try {
+    uint64_t mapped_bytes =
+        MappedOutput::supported(fd)
+            ? mapped_output_bytes(source, job.count, layout)
+            : 0;
+    with_engine(options, [&](auto make_generator) {
+      if (mapped_bytes > 0) {
+        MappedOutput mapped(fd, mapped_bytes);
+        output_random_strings_mapped(make_generator, source, job.count,
+                                     options.per_line, 1, mapped.data(),
+                                     layout);
+        written = mapped_bytes;
+      } else {
+        OutputWriter out(fd, FILE_BUFFER_SIZE);
+        run_generation(make_generator, source, job.count, options.per_line, 1,
+                       out, layout);
+        written = out.bytes_written();
+      }
+    });
+  } catch (...) {
+    close_output_file(fd);
+    throw;
+  }
+  close_output_file(fd);
+  return written;
+}
+
+void run_job(const JobSpec &job, const JobOptions &options,
+             CharsetCache &cache, JobResult &result) {
+  const auto start = std::chrono::steady_clock::now();
+  try {
+    const Charset &charset = cache.get(job.sources);
+    if (options.max_output_bytes > 0 &&
+        estimate_output_bytes(average_token_bytes(charset, job.length),
+                              job.count, options.format) >
+            static_cast<double>(options.max_output_bytes)) {
+      throw std::runtime_error("估算输出大小超过 " +
+                               std::to_string(options.max_output_bytes) +
+                               " 字节的限制，请使用 --stream");
+    }
+    const OutputLayout layout = output_layout(options.format);
+    CharsetTokens tokens(charset, job.length);
+    if (options.format == OutputFormat::text) {
+      result.output_bytes = write_job(tokens, job, options, layout);
+    } else {
+      result.output_bytes =
+          write_job(FramedTokens(tokens, options.format), job, options, layout);
+    }
+  } catch (const std::exception &e) {
+    result.error = e.what();
+  }
+  result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+}
+
+} // namespace
+
+std::vector<JobSpec> load_job_manifest(const std::string &path) {
+  std::ifstream file(path);
+  if (!file) {
+    throw std::runtime_error("无法打开任务清单: " + path);
+  }
+  std::vector<JobSpec> jobs;
+  std::map<std::string, size_t> outputs; // 输出路径 -> 行号
+  std::string text;
+  for (size_t line = 1; std::getline(file, text); ++line) {
+    std::istringstream fields(text);
+    std::vector<std::string> words;
+    for (std::string word; fields >> word;) {
+      words.push_back(word);
+    }
+    if (words.empty() || words[0][0] == '#') {
+      continue;
+    }
+    auto fail = [&](const std::string &reason) {
+      return std::runtime_error("任务清单第 " + std::to_string(line) +
+                                " 行: " + reason);
+    };
+    if (words.size() < 3) {
+      throw fail("须为 <length> <count> <output> [source ...]");
+    }
+    JobSpec job;
+    job.line = line;
+    uint64_t length = 0;
+    if (!parse_number(words[0], length) || !parse_number(words[1], job.count)) {
+      throw fail("长度与数量须为非负整数");
+    }
+    job.length = static_cast<size_t>(length);
+    job.output = words[2];
+    auto [it, inserted] = outputs.emplace(job.output, line);
+    if (!inserted) {
+      throw fail("输出文件 " + job.output + " 与第 " +
+                 std::to_string(it->second) + " 行重复");
+    }
+    job.sources.assign(words.begin() + 3, words.end());
+    jobs.push_back(std::move(job));
+  }
+  if (file.bad()) {
+    throw std::runtime_error("读取任务清单失败: " + path);
+  }
+  return jobs;
+}
+
+JobRunStats run_jobs(const std::vector<JobSpec> &jobs, const JobOptions &options,
+                     std::vector<JobResult> &results) {
+  JobRunStats stats;
+  results.assign(jobs.size(), JobResult());
+  CharsetCache cache(stats);
+
+  // 按估算工作量（输出字符数）从大到小排列，大任务先开始，尾部更均衡
+  std::vector<size_t> order(jobs.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  auto work = [&](size_t i) {
+    return static_cast<double>(jobs[i].length) *
+           static_cast<double>(jobs[i].count);
+  };
+  std::stable_sort(order.begin(), order.end(),
+                   [&](size_t a, size_t b) { return work(a) > work(b); });
+
+  const unsigned workers = static_cast<unsigned>(std::max<size_t>(
+      1, std::min<size_t>(options.threads, jobs.size())));
+  WorkStealingQueues queues(workers, order);
+  auto worker = [&](unsigned id) {
+    for (size_t task; queues.next(id, task);) {
+      run_job(jobs[task], options, cache, results[task]);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (unsigned id = 1; id < workers; ++id) {
+    threads.emplace_back(worker, id);
+  }
+  worker(0);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  stats.steals = queues.steals();
+  return stats;
+}
+
+} // namespace randomstr
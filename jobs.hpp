@@ -0,0 +1,65 @@
+// 批量任务（--jobs）：一个进程内执行任务清单中的全部任务
+//
+// 清单格式：每行一个任务，字段以空白分隔
+//   <length> <count> <output> [source ...]
+// output 为输出文件路径（各任务互不相同）；source 同 -s（dn、en、zh、sp 或
+// 字符集文件路径），省略时使用默认字符集。空行与以 # 开头的行忽略。
+//
+// 字符集按来源缓存：同一个字符集文件只读取、校验一次，同一组来源（与顺序
+// 无关）只归并一次。任务在工作窃取线程池上并行执行，每个任务单线程生成，
+// 输出与用相同参数单独运行 ./out 完全相同（--seed 时逐字节相同）。
+#ifndef JOBS_HPP
+#define JOBS_HPP
+
+#include "randomstr.hpp"
+
+namespace randomstr {
+
+struct JobSpec {
+  size_t line = 0; // 在清单中的行号（报错用）
+  size_t length = 0;
+  uint64_t count = 0;
+  std::string output;
+  std::vector<std::string> sources;
+};
+
+// 所有任务共用的选项
+struct JobOptions {
+  EngineKind engine = EngineKind::system;
+  bool seeded = false; // 为 true 时改用 Xoshiro256Generator(seed)
+  uint64_t seed = 0;
+  bool mix_kernel = false;
+  size_t pool_size = SystemRandomGenerator::DEFAULT_POOL_SIZE;
+  uint64_t reseed_interval = ChaCha20Generator::DEFAULT_RESEED_INTERVAL;
+  OutputFormat format = OutputFormat::text;
+  uint64_t per_line = 1;
+  unsigned threads = 1;          // 同时执行的任务数
+  uint64_t max_output_bytes = 0; // 单个任务的估算输出上限，0 表示不限
+};
+
+struct JobResult {
+  std::string error; // 为空表示成功
+  uint64_t output_bytes = 0;
+  double seconds = 0;
+};
+
+struct JobRunStats {
+  std::vector<std::string> warnings; // 无法读取而被跳过的字符集文件
+  uint64_t files_loaded = 0;         // 实际读取的字符集文件数
+  uint64_t charsets_built = 0;       // 归并出的不同字符集数
+  uint64_t charset_cache_hits = 0;   // 直接取用已缓存字符集的任务数
+  uint64_t steals = 0;               // 从其他线程窃取的任务数
+};
+
+// 读取并校验任务清单；格式错误或输出路径重复时抛出 std::runtime_error，
+// 信息中带行号
+std::vector<JobSpec> load_job_manifest(const std::string &path);
+
+// 执行全部任务，results 与 jobs 一一对应。单个任务失败（字符集为空、无法
+// 写出等）只记录在它的 JobResult 中，不影响其他任务
+JobRunStats run_jobs(const std::vector<JobSpec> &jobs, const JobOptions &options,
+                     std::vector<JobResult> &results);
+
+} // namespace randomstr
+
+#endif // JOBS_HPP
@@ -0,0 +1,320 @@
+// --pattern 模板的编译：解析模板、构建各段字符集，得到扁平的执行计划
+#include "randomstr.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <sstream>
+
+#include "charSet.hpp"
+
+namespace randomstr {
+
+namespace {
+
+// 模板按 UTF-8 字符逐个读取（模板整体已校验为合法 UTF-8）
+class PatternReader {
+public:
+  explicit PatternReader(std::string_view text) : text_(text) {}
+
+  bool done() const { return pos_ >= text_.size(); }
+  char peek() const { return text_[pos_]; }
+
+  // 读取一个完整的 UTF-8 字符
+  std::string_view next() {
+    size_t n = utf8_char_length(static_cast<unsigned char>(text_[pos_]));
+    std::string_view ch = text_.substr(pos_, n);
+    pos_ += n;
+    return ch;
+  }
+
+  // 读到未转义的 close 为止（不含），close 本身被跳过；没有 close 时抛出
+  // 异常。返回的内容保留转义符
+  std::string_view until(char close) {
+    size_t end = pos_;
+    while (end < text_.size() && text_[end] != close) {
+      end += text_[end] == '\\' ? 2 : 1;
+    }
+    if (end >= text_.size()) {
+      throw std::invalid_argument(std::string("模板中缺少 '") + close + "'");
+    }
+    std::string_view body = text_.substr(pos_, end - pos_);
+    pos_ = end + 1;
+    return body;
+  }
+
+private:
+  std::string_view text_;
+  size_t pos_ = 0;
+};
+
+uint32_t decode_code_point(std::string_view ch) {
+  auto byte = [&ch](size_t i) { return static_cast<uint32_t>(static_cast<unsigned char>(ch[i])); };
+  switch (ch.size()) {
+  case 1:
+    return byte(0);
+  case 2:
+    return (byte(0) & 0x1F) << 6 | (byte(1) & 0x3F);
+  case 3:
+    return (byte(0) & 0x0F) << 12 | (byte(1) & 0x3F) << 6 | (byte(2) & 0x3F);
+  default:
+    return (byte(0) & 0x07) << 18 | (byte(1) & 0x3F) << 12 |
+           (byte(2) & 0x3F) << 6 | (byte(3) & 0x3F);
+  }
+}
+
+void append_code_point(std::string &out, uint32_t cp) {
+  if (cp < 0x80) {
+    out += static_cast<char>(cp);
+  } else if (cp < 0x800) {
+    out += static_cast<char>(0xC0 | cp >> 6);
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    out += static_cast<char>(0xE0 | cp >> 12);
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  } else {
+    out += static_cast<char>(0xF0 | cp >> 18);
+    out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  }
+}
+
+// [...] 内的字符与区间展开为字符串，交给 build_charset 排序去重
+std::string expand_set(std::string_view body) {
+  PatternReader reader(body);
+  std::string chars;
+  while (!reader.done()) {
+    if (reader.peek() == '\\') {
+      reader.next();
+      if (reader.done()) {
+        throw std::invalid_argument("字符集合以转义符结尾");
+      }
+    }
+    std::string_view first = reader.next();
+    if (!reader.done() && reader.peek() == '-') {
+      reader.next();
+      if (reader.done()) {
+        // 末尾的 '-' 按字面处理，如 [a-z-]
+        chars += first;
+        chars += '-';
+        break;
+      }
+      if (reader.peek() == '\\') {
+        reader.next();
+      }
+      uint32_t lo = decode_code_point(first);
+      uint32_t hi = decode_code_point(reader.next());
+      if (lo > hi) {
+        throw std::invalid_argument("字符集合中的区间顺序颠倒: " +
+                                    std::string(body));
+      }
+      for (uint32_t cp = lo; cp <= hi; ++cp) {
+        if (cp < 0xD800 || cp > 0xDFFF) {
+          append_code_point(chars, cp);
+        }
+      }
+    } else {
+      chars += first;
+    }
+  }
+  return chars;
+}
+
+bool all_digits(std::string_view s) {
+  return !s.empty() && std::all_of(s.begin(), s.end(), [](char c) {
+    return c >= '0' && c <= '9';
+  });
+}
+
+} // namespace
+
+Charset build_char_class(std::string_view spec, const Charset &default_charset) {
+  if (spec.size() >= 2 && spec.front() == '[' && spec.back() == ']') {
+    std::string name(spec);
+    std::string chars = expand_set(spec.substr(1, spec.size() - 2));
+    if (chars.empty()) {
+      throw std::invalid_argument("字符集合为空: " + name);
+    }
+    try {
+      return build_charset(chars, {});
+    } catch (const std::runtime_error &) {
+      throw std::invalid_argument("字符集合为空: " + name);
+    }
+  }
+  std::string body(spec);
+  if (spec.size() >= 2 && spec.front() == '{' && spec.back() == '}') {
+    body = std::string(spec.substr(1, spec.size() - 2));
+  }
+  if (body == "*") {
+    return default_charset;
+  }
+  std::vector<std::string> sources;
+  std::stringstream parts(body);
+  for (std::string part; std::getline(parts, part, '+');) {
+    bool builtin = false;
+    for (const auto &b : builtin_charsets) {
+      builtin = builtin || b.name == part;
+    }
+    if (!builtin) {
+      throw std::invalid_argument("未知的字符类 " + std::string(spec) +
+                                  "（可用 dn、en、zh、sp 及其 + 组合，"
+                                  "或 {*}）");
+    }
+    sources.push_back(part);
+  }
+  if (sources.empty()) {
+    throw std::invalid_argument("空的字符类 " + std::string(spec));
+  }
+  return build_charset("", sources);
+}
+
+TokenPattern TokenPattern::compile(std::string_view text,
+                                   const Charset &default_charset) {
+  if (text.empty()) {
+    throw std::invalid_argument("模板为空");
+  }
+  if (!utf8_validator().validate(text.data(), text.size())) {
+    throw std::invalid_argument("模板不是合法的 UTF-8");
+  }
+
+  TokenPattern pattern;
+  // 同一写法的字符类只构建一次
+  std::map<std::string, std::shared_ptr<const Charset>> classes;
+
+  // 当前待定的原子（等待可能的 {n}）
+  std::string atom_literal;
+  std::shared_ptr<const Charset> atom_charset;
+  std::string atom_name;
+  bool has_atom = false;
+  bool atom_repeated = false;
+  size_t atom_count = 1;
+
+  auto flush = [&] {
+    if (!has_atom) {
+      return;
+    }
+    std::vector<Segment> &segments = pattern.segments_;
+    if (atom_charset) {
+      if (!segments.empty() && segments.back().charset &&
+          segments.back().name == atom_name) {
+        segments.back().count += atom_count; // 相邻的同一字符类合并
+      } else {
+        segments.push_back({"", atom_charset, atom_name, atom_count});
+      }
+    } else {
+      if (segments.empty() || segments.back().charset) {
+        segments.push_back({"", nullptr, "", 0});
+      }
+      for (size_t i = 0; i < atom_count; ++i) {
+        segments.back().literal += atom_literal; // 相邻字面量合并
+      }
+    }
+    has_atom = false;
+    atom_repeated = false;
+    atom_count = 1;
+    atom_charset = nullptr;
+    atom_literal.clear();
+  };
+
+  auto class_charset = [&](const std::string &name,
+                           auto build) -> std::shared_ptr<const Charset> {
+    auto &slot = classes[name];
+    if (!slot) {
+      slot = std::make_shared<const Charset>(build());
+    }
+    return slot;
+  };
+
+  PatternReader reader(text);
+  while (!reader.done()) {
+    char c = reader.peek();
+    if (c == '{') {
+      reader.next();
+      std::string body(reader.until('}'));
+      if (all_digits(body)) {
+        if (!has_atom || atom_repeated) {
+          throw std::invalid_argument("重复次数 {" + body +
+                                      "} 前缺少字符类或字面字符");
+        }
+        if (body.size() > 7 || std::stoul(body) == 0 ||
+            std::stoul(body) > MAX_REPEAT) {
+          throw std::invalid_argument("重复次数须在 1 到 " +
+                                      std::to_string(MAX_REPEAT) + " 之间: {" +
+                                      body + "}");
+        }
+        atom_count = std::stoul(body);
+        atom_repeated = true;
+        continue;
+      }
+      flush();
+      std::string name = "{" + body + "}";
+      if (body.empty()) {
+        throw std::invalid_argument("空的字符类 {}");
+      }
+      atom_charset = class_charset(
+          name, [&] { return build_char_class(name, default_charset); });
+      atom_name = name;
+      has_atom = true;
+    } else if (c == '[') {
+      reader.next();
+      flush();
+      std::string_view body = reader.until(']');
+      std::string name = "[" + std::string(body) + "]";
+      atom_charset = class_charset(
+          name, [&] { return build_char_class(name, default_charset); });
+      atom_name = name;
+      has_atom = true;
+    } else {
+      flush();
+      if (c == '\\') {
+        reader.next();
+        if (reader.done()) {
+          throw std::invalid_argument("模板以转义符结尾");
+        }
+      } else if (c == '}' || c == ']') {
+        throw std::invalid_argument(std::string("模板中多余的 '") + c +
+                                    "'，字面字符请写作 \\" + c);
+      }
+      atom_literal = std::string(reader.next());
+      has_atom = true;
+    }
+  }
+  flush();
+
+  for (const Segment &segment : pattern.segments_) {
+    if (segment.charset) {
+      pattern.max_bytes_ += segment.count * segment.charset->max_width();
+      pattern.fixed_size_ =
+          pattern.fixed_size_ && segment.charset->width() != 0;
+      pattern.sampled_chars_ += segment.count;
+      pattern.bits_ += segment.count * segment.charset->bits_per_char();
+      pattern.space_bits_ +=
+          segment.count * std::log2(static_cast<double>(segment.charset->size()));
+    } else {
+      pattern.max_bytes_ += segment.literal.size();
+    }
+  }
+  return pattern;
+}
+
+std::string TokenPattern::describe() const {
+  std::string text;
+  for (const Segment &segment : segments_) {
+    if (!text.empty()) {
+      text += ' ';
+    }
+    if (segment.charset) {
+      text += segment.name + "×" + std::to_string(segment.count) + "(" +
+              std::to_string(segment.charset->size()) + ")";
+    } else {
+      text += "\"" + segment.literal + "\"";
+    }
+  }
+  std::ostringstream bits;
+  bits << bits_;
+  return text + "，每个令牌 " + bits.str() + " 比特";
+}
+
+} // namespace randomstr
@@ -0,0 +1,266 @@
+// 口令策略（--require / --no-repeat）的解析与熵下限，以及 --exclude-ambiguous
+#include "randomstr.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace randomstr {
+
+namespace {
+
+constexpr size_t MAX_REQUIRED = 1000000;
+
+// 按逗号切分策略项；[...] 与 {...} 之内的逗号以及转义的逗号不算
+std::vector<std::string_view> split_items(std::string_view spec) {
+  std::vector<std::string_view> items;
+  size_t start = 0;
+  char close = 0;
+  for (size_t i = 0; i < spec.size(); ++i) {
+    char c = spec[i];
+    if (c == '\\') {
+      ++i;
+    } else if (close != 0) {
+      close = c == close ? 0 : close;
+    } else if (c == '[') {
+      close = ']';
+    } else if (c == '{') {
+      close = '}';
+    } else if (c == ',') {
+      items.push_back(spec.substr(start, i - start));
+      start = i + 1;
+    }
+  }
+  items.push_back(spec.substr(start));
+  return items;
+}
+
+size_t parse_count(std::string_view item, std::string_view digits) {
+  bool valid = !digits.empty() && digits.size() <= 7 &&
+               std::all_of(digits.begin(), digits.end(),
+                           [](char c) { return c >= '0' && c <= '9'; });
+  size_t count = valid ? std::stoul(std::string(digits)) : 0;
+  if (count == 0 || count > MAX_REQUIRED) {
+    throw std::invalid_argument("策略项的个数须在 1 到 " +
+                                std::to_string(MAX_REQUIRED) +
+                                " 之间: " + std::string(item));
+  }
+  return count;
+}
+
+} // namespace
+
+Charset exclude_chars(const Charset &charset, std::string_view chars) {
+  if (charset.alias() != nullptr) {
+    throw std::invalid_argument("带权字符集不支持排除字符");
+  }
+  std::vector<std::string> excluded = split_utf8_string(chars);
+  std::unordered_set<std::string_view> skip(excluded.begin(), excluded.end());
+  std::vector<std::string> kept;
+  kept.reserve(charset.size());
+  for (size_t i = 0; i < charset.size(); ++i) {
+    std::string_view ch = charset.at(i);
+    if (skip.count(ch) == 0) {
+      kept.emplace_back(ch);
+    }
+  }
+  if (kept.empty()) {
+    throw std::runtime_error("去掉易混淆字符后字符集为空");
+  }
+  return Charset(kept);
+}
+
+TokenPolicy TokenPolicy::compile(std::string_view spec, const Charset &charset,
+                                 bool no_repeat) {
+  TokenPolicy policy;
+  policy.charset_ = &charset;
+  policy.no_repeat_ = no_repeat;
+  if (spec.empty()) {
+    return policy;
+  }
+
+  std::unordered_map<std::string_view, uint32_t> index_of;
+  index_of.reserve(charset.size());
+  for (size_t i = 0; i < charset.size(); ++i) {
+    index_of.emplace(charset.at(i), static_cast<uint32_t>(i));
+  }
+
+  for (std::string_view item : split_items(spec)) {
+    size_t colon = item.rfind(':');
+    if (colon == std::string_view::npos || colon == 0) {
+      throw std::invalid_argument("策略项须写作 <字符类>:<个数>，如 dn:1: " +
+                                  std::string(item));
+    }
+    Requirement requirement;
+    requirement.name = std::string(item.substr(0, colon));
+    requirement.count = parse_count(item, item.substr(colon + 1));
+    bool bracketed = requirement.name.front() == '[' ||
+                     requirement.name.front() == '{';
+    Charset members = build_char_class(
+        bracketed ? requirement.name : "{" + requirement.name + "}", charset);
+    for (size_t i = 0; i < members.size(); ++i) {
+      auto it = index_of.find(members.at(i));
+      if (it != index_of.end()) {
+        requirement.members.push_back(it->second);
+      }
+    }
+    if (requirement.members.empty()) {
+      throw std::invalid_argument("字符类 " + requirement.name +
+                                  " 与字符集没有共同的字符"
+                                  "（可用 -s / -c 把它加入字符集）");
+    }
+    std::sort(requirement.members.begin(), requirement.members.end());
+    policy.required_ += requirement.count;
+    if (policy.required_ > MAX_REQUIRED) {
+      throw std::invalid_argument("策略要求的字符总数过多");
+    }
+    policy.requirements_.push_back(std::move(requirement));
+  }
+
+  // 可选字符最少的先抽，--no-repeat 时最不容易被别的字符类占满
+  std::stable_sort(policy.requirements_.begin(), policy.requirements_.end(),
+                   [](const Requirement &a, const Requirement &b) {
+                     return a.members.size() < b.members.size();
+                   });
+
+  std::vector<unsigned char> in_class(charset.size());
+  for (size_t i = 0; i < policy.requirements_.size(); ++i) {
+    const Requirement &current = policy.requirements_[i];
+    std::fill(in_class.begin(), in_class.end(), 0);
+    for (uint32_t index : current.members) {
+      in_class[index] = 1;
+    }
+    size_t overlap = 0;
+    for (size_t p = 0; p < i; ++p) {
+      size_t shared = 0;
+      for (uint32_t index : policy.requirements_[p].members) {
+        shared += in_class[index];
+      }
+      overlap += std::min(shared, policy.requirements_[p].count);
+    }
+    policy.overlap_.push_back(overlap);
+  }
+  return policy;
+}
+
+double TokenPolicy::draw_bits(size_t length) const {
+  if (length < required_) {
+    return -1;
+  }
+  const double n = static_cast<double>(charset_->size());
+  double bits = 0;
+  for (size_t i = 0; i < requirements_.size(); ++i) {
+    const Requirement &requirement = requirements_[i];
+    double size = static_cast<double>(requirement.members.size());
+    if (!no_repeat_) {
+      bits += requirement.count * std::log2(size);
+      continue;
+    }
+    // 最坏情况：之前的字符类与本类已抽到的字符都落在本类之中
+    for (size_t k = 0; k < requirement.count; ++k) {
+      double available = size - static_cast<double>(overlap_[i] + k);
+      if (available < 1) {
+        return -1;
+      }
+      bits += std::log2(available);
+    }
+  }
+  if (!no_repeat_) {
+    return bits + static_cast<double>(length - required_) * std::log2(n);
+  }
+  for (size_t j = required_; j < length; ++j) {
+    double available = n - static_cast<double>(j);
+    if (available < 1) {
+      return -1;
+    }
+    bits += std::log2(available);
+  }
+  return bits;
+}
+
+void TokenPolicy::check(size_t length) const {
+  if (length < required_) {
+    throw std::invalid_argument("长度 " + std::to_string(length) +
+                                " 小于策略要求的字符数 " +
+                                std::to_string(required_));
+  }
+  if (draw_bits(length) < 0) {
+    throw std::invalid_argument(
+        "--no-repeat 下字符不够用：长度 " + std::to_string(length) +
+        " 的令牌无法保证每个字符类都抽得到未用过的字符");
+  }
+}
+
+double TokenPolicy::bits(size_t length) const {
+  return std::max(draw_bits(length), 0.0);
+}
+
+size_t TokenPolicy::length_for_bits(double key_bits) const {
+  double base = draw_bits(required_);
+  if (base < 0) {
+    check(required_);
+  }
+  if (base >= key_bits) {
+    return required_;
+  }
+  const double per_char = std::log2(static_cast<double>(charset_->size()));
+  auto unreachable = [&] {
+    std::ostringstream text;
+    text << "策略下无法达到 " << key_bits << " 比特的密钥强度";
+    return std::invalid_argument(text.str());
+  };
+  if (per_char <= 0) {
+    throw unreachable();
+  }
+  if (!no_repeat_) {
+    return required_ +
+           static_cast<size_t>(std::ceil((key_bits - base) / per_char));
+  }
+  // 不重复时每多一个字符可选的字符就少一个，逐个累加；字符用尽即无法达到
+  for (size_t length = required_ + 1;; ++length) {
+    double bits = draw_bits(length);
+    if (bits < 0) {
+      throw unreachable();
+    }
+    if (bits >= key_bits) {
+      return length;
+    }
+  }
+}
+
+namespace {
+
+std::atomic<uint64_t> policy_entropy_bytes{0};
+std::atomic<uint64_t> policy_rejections{0};
+
+} // namespace
+
+uint64_t PolicyTokens::total_entropy_bytes() {
+  return policy_entropy_bytes.load(std::memory_order_relaxed);
+}
+
+uint64_t PolicyTokens::total_rejections() {
+  return policy_rejections.load(std::memory_order_relaxed);
+}
+
+void PolicyTokens::record_usage(uint64_t entropy_bytes, uint64_t rejections) {
+  policy_entropy_bytes.fetch_add(entropy_bytes, std::memory_order_relaxed);
+  policy_rejections.fetch_add(rejections, std::memory_order_relaxed);
+}
+
+std::string TokenPolicy::describe() const {
+  std::string text;
+  for (const Requirement &requirement : requirements_) {
+    text += requirement.name + "×" + std::to_string(requirement.count) + "(" +
+            std::to_string(requirement.members.size()) + ") ";
+  }
+  text += "其余取自字符集(" + std::to_string(charset_->size()) + ")";
+  if (no_repeat_) {
+    text += "，同一令牌内不重复";
+  }
+  return text;
+}
+
+} // namespace randomstr
@@ -0,0 +1,1462 @@
+// librandomstr 的非模板实现：系统熵来源、ChaCha20、RDRAND 与采样内核、
+// 字符集构建
+#include "randomstr.hpp"
+
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <variant>
+
+#ifdef _WIN32
+// 以下行的作用是
+#ifndef WINAPI 
+#include <windows.h>
+#else 
+#include <bcrypt.h>
+#endif
+// 这两部分都有用
+#ifndef WINAPI 
+#include <windows.h>
+#else 
+#include <bcrypt.h>
+#endif
+// 保证bcrypt.h 在windows .h后被引入
+#ifndef STATUS_SUCCESS
+#define STATUS_SUCCESS ((NTSTATUS)0x00000000L)
+#endif
+#ifdef _MSC_VER
+#pragma comment(lib, "Bcrypt.lib")
+#endif
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// x86 上启用 SIMD 内核（运行时检测 CPU 特性）
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STR_RANDOM_X86 1
+#include <immintrin.h>
+#endif
+
+// RDRAND / RDSEED 的 64 位形式只在 x86-64 上存在
+#if defined(STR_RANDOM_X86) && defined(__x86_64__)
+#define STR_RANDOM_RDRAND 1
+#include <cpuid.h>
+#endif
+
+#include "charSet.hpp" // 引入默认字符集定义
+
+namespace randomstr {
+
+// fork 代数：每次 fork 后在子进程中递增。持有熵缓冲的生成器记录填充时的代数，
+// 不一致时说明缓冲是从父进程继承来的，必须丢弃
+static std::atomic<uint64_t> &fork_generation_counter() {
+  static std::atomic<uint64_t> generation{0};
+  return generation;
+}
+
+uint64_t current_fork_generation() {
+#ifndef _WIN32
+  static const int registered = pthread_atfork(nullptr, nullptr, [] {
+    fork_generation_counter().fetch_add(1, std::memory_order_relaxed);
+  });
+  (void)registered;
+#endif
+  return fork_generation_counter().load(std::memory_order_relaxed);
+}
+
+// 作用域计时：target 为空时不读时钟
+class ScopedNanoseconds {
+public:
+  explicit ScopedNanoseconds(std::atomic<uint64_t> *target) : target_(target) {
+    if (target_ != nullptr) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+  ~ScopedNanoseconds() {
+    if (target_ != nullptr) {
+      target_->fetch_add(
+          static_cast<uint64_t>(
+              std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - start_)
+                  .count()),
+          std::memory_order_relaxed);
+    }
+  }
+
+private:
+  std::atomic<uint64_t> *target_;
+  std::chrono::steady_clock::time_point start_{};
+};
+
+std::atomic<bool> &SystemRandomGenerator::timing_enabled() {
+  static std::atomic<bool> enabled{false};
+  return enabled;
+}
+std::atomic<uint64_t> &SystemRandomGenerator::syscall_nanoseconds() {
+  static std::atomic<uint64_t> nanoseconds{0};
+  return nanoseconds;
+}
+std::atomic<uint64_t> &SystemRandomGenerator::syscall_counter() {
+  static std::atomic<uint64_t> counter{0};
+  return counter;
+}
+std::atomic<uint64_t> &SystemRandomGenerator::entropy_counter() {
+  static std::atomic<uint64_t> counter{0};
+  return counter;
+}
+
+// 先尝试 getrandom；若内核不支持则回落到 /dev/urandom；Windows 使用
+// BCryptGenRandom
+void SystemRandomGenerator::fill_random_bytes(unsigned char *buffer,
+                                              size_t size) {
+  ScopedNanoseconds timer(timing_enabled().load(std::memory_order_relaxed)
+                              ? &syscall_nanoseconds()
+                              : nullptr);
+#ifdef _WIN32
+  syscall_counter().fetch_add(1, std::memory_order_relaxed);
+  NTSTATUS status = BCryptGenRandom(nullptr, buffer, static_cast<ULONG>(size),
+                                    BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+  if (status != STATUS_SUCCESS) {
+    throw std::runtime_error("BCryptGenRandom 失败");
+  }
+  entropy_counter().fetch_add(size, std::memory_order_relaxed);
+#else
+  size_t filled = 0;
+  while (filled < size) {
+    syscall_counter().fetch_add(1, std::memory_order_relaxed);
+    ssize_t ret = getrandom(buffer + filled, size - filled, GRND_NONBLOCK);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue; // 被信号中断，重试
+      }
+      if (errno == ENOSYS) {
+        fill_from_urandom(buffer + filled, size - filled);
+        return;
+      }
+      throw std::runtime_error("getrandom 失败: " +
+                               std::string(std::strerror(errno)));
+    }
+    filled += static_cast<size_t>(ret);
+    entropy_counter().fetch_add(static_cast<uint64_t>(ret),
+                                std::memory_order_relaxed);
+  }
+#endif
+}
+
+#ifndef _WIN32
+void SystemRandomGenerator::fill_from_urandom(unsigned char *buffer,
+                                              size_t size) {
+  syscall_counter().fetch_add(1, std::memory_order_relaxed);
+  int fd = open("/dev/urandom", O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("无法打开 /dev/urandom: " +
+                             std::string(std::strerror(errno)));
+  }
+
+  size_t read_bytes = 0;
+  while (read_bytes < size) {
+    syscall_counter().fetch_add(1, std::memory_order_relaxed);
+    ssize_t ret = read(fd, buffer + read_bytes, size - read_bytes);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue; // 被信号中断，重试
+      }
+      close(fd);
+      throw std::runtime_error("读取 /dev/urandom 失败: " +
+                               std::string(std::strerror(errno)));
+    }
+    if (ret == 0) {
+      close(fd);
+      throw std::runtime_error("读取 /dev/urandom 意外返回 0 字节");
+    }
+    read_bytes += static_cast<size_t>(ret);
+    entropy_counter().fetch_add(static_cast<uint64_t>(ret),
+                                std::memory_order_relaxed);
+  }
+
+  close(fd);
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// ChaCha20 用户态 CSPRNG
+// ---------------------------------------------------------------------------
+
+inline uint32_t rotl32(uint32_t v, int n) { return (v << n) | (v >> (32 - n)); }
+
+inline uint32_t load32_le(const unsigned char *p) {
+  return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+         (static_cast<uint32_t>(p[2]) << 16) |
+         (static_cast<uint32_t>(p[3]) << 24);
+}
+
+inline void store32_le(unsigned char *p, uint32_t v) {
+  p[0] = static_cast<unsigned char>(v);
+  p[1] = static_cast<unsigned char>(v >> 8);
+  p[2] = static_cast<unsigned char>(v >> 16);
+  p[3] = static_cast<unsigned char>(v >> 24);
+}
+
+#define CHACHA_QR(a, b, c, d)                                                  \
+  a += b;                                                                      \
+  d = rotl32(d ^ a, 16);                                                       \
+  c += d;                                                                      \
+  b = rotl32(b ^ c, 12);                                                       \
+  a += b;                                                                      \
+  d = rotl32(d ^ a, 8);                                                        \
+  c += d;                                                                      \
+  b = rotl32(b ^ c, 7)
+
+inline void chacha20_blocks_scalar(const uint32_t input[16], unsigned char *out,
+                                   size_t nblocks) {
+  for (size_t b = 0; b < nblocks; ++b) {
+    uint32_t in[16];
+    std::memcpy(in, input, sizeof(in));
+    in[12] += static_cast<uint32_t>(b);
+
+    uint32_t x[16];
+    std::memcpy(x, in, sizeof(x));
+    for (int round = 0; round < 10; ++round) {
+      CHACHA_QR(x[0], x[4], x[8], x[12]);
+      CHACHA_QR(x[1], x[5], x[9], x[13]);
+      CHACHA_QR(x[2], x[6], x[10], x[14]);
+      CHACHA_QR(x[3], x[7], x[11], x[15]);
+      CHACHA_QR(x[0], x[5], x[10], x[15]);
+      CHACHA_QR(x[1], x[6], x[11], x[12]);
+      CHACHA_QR(x[2], x[7], x[8], x[13]);
+      CHACHA_QR(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; ++i) {
+      store32_le(out + b * 64 + i * 4, x[i] + in[i]);
+    }
+  }
+}
+
+#ifdef STR_RANDOM_X86
+// 多块并行内核：每个向量寄存器保存 N 个块的同一个状态字（纵向布局），
+// 20 轮结束后先写入临时数组，再按块重排为连续输出。
+#define CHACHA_VQR(add, xor_, rotl, a, b, c, d)                                \
+  a = add(a, b);                                                               \
+  d = rotl(xor_(d, a), 16);                                                    \
+  c = add(c, d);                                                               \
+  b = rotl(xor_(b, c), 12);                                                    \
+  a = add(a, b);                                                               \
+  d = rotl(xor_(d, a), 8);                                                     \
+  c = add(c, d);                                                               \
+  b = rotl(xor_(b, c), 7)
+
+#define CHACHA_VDOUBLE_ROUND(add, xor_, rotl, x)                               \
+  CHACHA_VQR(add, xor_, rotl, x[0], x[4], x[8], x[12]);                        \
+  CHACHA_VQR(add, xor_, rotl, x[1], x[5], x[9], x[13]);                        \
+  CHACHA_VQR(add, xor_, rotl, x[2], x[6], x[10], x[14]);                       \
+  CHACHA_VQR(add, xor_, rotl, x[3], x[7], x[11], x[15]);                       \
+  CHACHA_VQR(add, xor_, rotl, x[0], x[5], x[10], x[15]);                       \
+  CHACHA_VQR(add, xor_, rotl, x[1], x[6], x[11], x[12]);                       \
+  CHACHA_VQR(add, xor_, rotl, x[2], x[7], x[8], x[13]);                        \
+  CHACHA_VQR(add, xor_, rotl, x[3], x[4], x[9], x[14])
+
+__attribute__((target("sse2"))) inline __m128i sse2_rotl(__m128i v, int n) {
+  return _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - n));
+}
+
+// SSE2：一次 4 块
+__attribute__((target("sse2"))) inline void
+chacha20_blocks_sse2(const uint32_t input[16], unsigned char *out,
+                     size_t nblocks) {
+  alignas(16) uint32_t lanes[16][4];
+  size_t b = 0;
+  for (; b + 4 <= nblocks; b += 4) {
+    __m128i x[16], in[16];
+    for (int i = 0; i < 16; ++i) {
+      in[i] = _mm_set1_epi32(static_cast<int>(input[i]));
+    }
+    uint32_t ctr = input[12] + static_cast<uint32_t>(b);
+    in[12] = _mm_setr_epi32(static_cast<int>(ctr), static_cast<int>(ctr + 1),
+                            static_cast<int>(ctr + 2),
+                            static_cast<int>(ctr + 3));
+    for (int i = 0; i < 16; ++i) {
+      x[i] = in[i];
+    }
+    for (int round = 0; round < 10; ++round) {
+      CHACHA_VDOUBLE_ROUND(_mm_add_epi32, _mm_xor_si128, sse2_rotl, x);
+    }
+    for (int i = 0; i < 16; ++i) {
+      _mm_store_si128(reinterpret_cast<__m128i *>(lanes[i]),
+                      _mm_add_epi32(x[i], in[i]));
+    }
+    for (int lane = 0; lane < 4; ++lane) {
+      for (int i = 0; i < 16; ++i) {
+        store32_le(out + (b + lane) * 64 + i * 4, lanes[i][lane]);
+      }
+    }
+  }
+  secure_wipe(lanes, sizeof(lanes));
+  if (b < nblocks) {
+    uint32_t tail[16];
+    std::memcpy(tail, input, sizeof(tail));
+    tail[12] += static_cast<uint32_t>(b);
+    chacha20_blocks_scalar(tail, out + b * 64, nblocks - b);
+  }
+}
+
+__attribute__((target("avx2"))) inline __m256i avx2_rotl(__m256i v, int n) {
+  // 16/8 位循环移位用字节重排完成，其余用移位 + 或
+  if (n == 16) {
+    return _mm256_shuffle_epi8(
+        v, _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12,
+                            13, 2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15,
+                            12, 13));
+  }
+  if (n == 8) {
+    return _mm256_shuffle_epi8(
+        v, _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13,
+                            14, 3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12,
+                            13, 14));
+  }
+  return _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - n));
+}
+
+// AVX2：一次 8 块
+__attribute__((target("avx2"))) inline void
+chacha20_blocks_avx2(const uint32_t input[16], unsigned char *out,
+                     size_t nblocks) {
+  alignas(32) uint32_t lanes[16][8];
+  size_t b = 0;
+  for (; b + 8 <= nblocks; b += 8) {
+    __m256i x[16], in[16];
+    for (int i = 0; i < 16; ++i) {
+      in[i] = _mm256_set1_epi32(static_cast<int>(input[i]));
+    }
+    uint32_t ctr = input[12] + static_cast<uint32_t>(b);
+    in[12] = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(ctr)),
+                              _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    for (int i = 0; i < 16; ++i) {
+      x[i] = in[i];
+    }
+    for (int round = 0; round < 10; ++round) {
+      CHACHA_VDOUBLE_ROUND(_mm256_add_epi32, _mm256_xor_si256, avx2_rotl, x);
+    }
+    for (int i = 0; i < 16; ++i) {
+      _mm256_store_si256(reinterpret_cast<__m256i *>(lanes[i]),
+                         _mm256_add_epi32(x[i], in[i]));
+    }
+    for (int lane = 0; lane < 8; ++lane) {
+      for (int i = 0; i < 16; ++i) {
+        store32_le(out + (b + lane) * 64 + i * 4, lanes[i][lane]);
+      }
+    }
+  }
+  secure_wipe(lanes, sizeof(lanes));
+  if (b < nblocks) {
+    uint32_t tail[16];
+    std::memcpy(tail, input, sizeof(tail));
+    tail[12] += static_cast<uint32_t>(b);
+    chacha20_blocks_sse2(tail, out + b * 64, nblocks - b);
+  }
+}
+#endif // STR_RANDOM_X86
+
+std::vector<ChaCha20KernelInfo> chacha20_kernels() {
+  std::vector<ChaCha20KernelInfo> kernels;
+#ifdef STR_RANDOM_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back({chacha20_blocks_avx2, "avx2"});
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    kernels.push_back({chacha20_blocks_sse2, "sse2"});
+  }
+#endif
+  kernels.push_back({chacha20_blocks_scalar, "scalar"});
+  return kernels;
+}
+
+const ChaCha20KernelInfo &chacha20_kernel() {
+  static const ChaCha20KernelInfo info = chacha20_kernels().front();
+  return info;
+}
+
+std::atomic<uint64_t> &ChaCha20Generator::reseed_counter() {
+  static std::atomic<uint64_t> counter{0};
+  return counter;
+}
+
+void ChaCha20Generator::reseed() {
+  unsigned char seed[KEY_BYTES + NONCE_BYTES];
+  seeder_.fill(seed, sizeof(seed));
+  // "expand 32-byte k"
+  state_[0] = 0x61707865;
+  state_[1] = 0x3320646e;
+  state_[2] = 0x79622d32;
+  state_[3] = 0x6b206574;
+  // 新熵与当前密钥异或混合，重播种不会丢失已有状态
+  for (int i = 0; i < 8; ++i) {
+    state_[4 + i] ^= load32_le(seed + i * 4);
+  }
+  for (int i = 0; i < 3; ++i) {
+    state_[13 + i] = load32_le(seed + KEY_BYTES + i * 4);
+  }
+  secure_wipe(seed, sizeof(seed));
+  bytes_since_seed_ = 0;
+  fork_generation_ = current_fork_generation();
+  needs_reseed_ = false;
+  reseed_counter().fetch_add(1, std::memory_order_relaxed);
+}
+
+void ChaCha20Generator::refill() {
+  if (needs_reseed_ || fork_generation_ != current_fork_generation() ||
+      (reseed_interval_ > 0 && bytes_since_seed_ >= reseed_interval_)) {
+    reseed();
+  }
+  // 每批使用新密钥，块计数器从 0 开始即可
+  state_[12] = 0;
+  chacha20_kernel().kernel(state_, buffer_, BLOCKS);
+  for (int i = 0; i < 8; ++i) {
+    state_[4 + i] = load32_le(buffer_ + i * 4);
+  }
+  secure_wipe(buffer_, KEY_BYTES);
+  pos_ = KEY_BYTES;
+  bytes_since_seed_ += BUFFER_SIZE - KEY_BYTES;
+}
+
+Xoshiro256Generator::Xoshiro256Generator(uint64_t seed) {
+  // splitmix64 展开种子，保证状态不全为零
+  for (uint64_t &word : seed_state_) {
+    uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    word = z ^ (z >> 31);
+  }
+  std::memcpy(stream_state_, seed_state_, sizeof(seed_state_));
+  std::memcpy(state_, seed_state_, sizeof(seed_state_));
+}
+
+void Xoshiro256Generator::jump(uint64_t (&state)[4]) {
+  static constexpr uint64_t JUMP[] = {0x180EC6D33CFD0ABAULL,
+                                      0xD5A61266F0C9392CULL,
+                                      0xA9582618E03FC9AAULL,
+                                      0x39ABDC4529B1661CULL};
+  uint64_t saved[4];
+  std::memcpy(saved, state_, sizeof(saved));
+  std::memcpy(state_, state, sizeof(state_));
+  uint64_t result[4] = {};
+  for (uint64_t word : JUMP) {
+    for (int b = 0; b < 64; ++b) {
+      if (word & (uint64_t{1} << b)) {
+        for (int i = 0; i < 4; ++i) {
+          result[i] ^= state_[i];
+        }
+      }
+      next();
+    }
+  }
+  std::memcpy(state, result, sizeof(result));
+  std::memcpy(state_, saved, sizeof(saved));
+}
+
+void Xoshiro256Generator::select_stream(uint64_t stream) {
+  if (stream < stream_) {
+    std::memcpy(stream_state_, seed_state_, sizeof(seed_state_));
+    stream_ = 0;
+  }
+  for (; stream_ < stream; ++stream_) {
+    jump(stream_state_);
+  }
+  std::memcpy(state_, stream_state_, sizeof(state_));
+}
+
+void OutputWriter::write_all(const char *data, size_t size) {
+  auto start = timing_ ? std::chrono::steady_clock::now()
+                       : std::chrono::steady_clock::time_point{};
+  while (size > 0) {
+    ++write_calls_;
+#ifdef _WIN32
+    int ret = _write(fd_, data,
+                     static_cast<unsigned int>(std::min<size_t>(size, 1 << 30)));
+#else
+    ssize_t ret = write(fd_, data, size);
+#endif
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue; // 被信号中断，重试
+      }
+      if (errno == EPIPE) {
+        throw OutputClosed();
+      }
+      throw std::runtime_error("写入输出失败: " +
+                               std::string(std::strerror(errno)));
+    }
+    // 部分写入：继续写剩余部分
+    data += ret;
+    size -= static_cast<size_t>(ret);
+    bytes_written_ += static_cast<uint64_t>(ret);
+  }
+  if (timing_) {
+    write_nanoseconds_ += static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count());
+  }
+}
+
+int open_output_file(const std::string &path) {
+#ifdef _WIN32
+  int fd = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+                 _S_IREAD | _S_IWRITE);
+#else
+  // 映射需要可读写；权限沿用 umask，与 shell 重定向一致
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+#endif
+  if (fd < 0) {
+    throw std::runtime_error("无法打开输出文件 " + path + ": " +
+                             std::strerror(errno));
+  }
+  return fd;
+}
+
+void close_output_file(int fd) {
+#ifdef _WIN32
+  _close(fd);
+#else
+  close(fd);
+#endif
+}
+
+#ifdef _WIN32
+bool MappedOutput::supported(int) { return false; }
+
+MappedOutput::MappedOutput(int, uint64_t) {
+  throw std::runtime_error("当前平台不支持映射输出文件");
+}
+
+MappedOutput::~MappedOutput() = default;
+#else
+bool MappedOutput::supported(int fd) {
+  struct stat st;
+  return fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+MappedOutput::MappedOutput(int fd, uint64_t size) : size_(size) {
+  if (size > static_cast<uint64_t>(SIZE_MAX) ||
+      size > static_cast<uint64_t>(std::numeric_limits<off_t>::max())) {
+    throw std::runtime_error("输出文件过大，无法映射");
+  }
+  int rc = -1;
+#if defined(__linux__)
+  // 真正分配磁盘块；文件系统不支持时（EOPNOTSUPP）退回 ftruncate 生成稀疏文件
+  rc = fallocate(fd, 0, 0, static_cast<off_t>(size));
+  if (rc != 0 && errno != EOPNOTSUPP && errno != ENOSYS) {
+    throw std::runtime_error("无法为输出文件预分配空间: " +
+                             std::string(std::strerror(errno)));
+  }
+#endif
+  if (rc != 0 && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    throw std::runtime_error("无法设置输出文件大小: " +
+                             std::string(std::strerror(errno)));
+  }
+  void *p = mmap(nullptr, static_cast<size_t>(size), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    throw std::runtime_error("无法映射输出文件: " +
+                             std::string(std::strerror(errno)));
+  }
+  data_ = static_cast<char *>(p);
+}
+
+MappedOutput::~MappedOutput() {
+  // 脏页由内核回写；munmap 之后文件内容对其他进程立即可见
+  munmap(data_, static_cast<size_t>(size_));
+}
+#endif
+
+OutputFormat parse_output_format(std::string_view name) {
+  static constexpr std::pair<std::string_view, OutputFormat> FORMATS[] = {
+      {"text", OutputFormat::text},   {"nul", OutputFormat::nul},
+      {"jsonl", OutputFormat::jsonl}, {"csv", OutputFormat::csv},
+      {"binary", OutputFormat::binary},
+  };
+  for (const auto &[format_name, format] : FORMATS) {
+    if (name == format_name) {
+      return format;
+    }
+  }
+  throw std::invalid_argument("未知的输出格式: " + std::string(name));
+}
+
+OutputLayout output_layout(OutputFormat format) {
+  switch (format) {
+  case OutputFormat::nul:
+    return {'\0', '\0', true};
+  case OutputFormat::jsonl:
+    return {'\n', '\n', true};
+  case OutputFormat::csv:
+    return {',', '\n', true};
+  case OutputFormat::binary:
+    return {'\0', '\0', false};
+  case OutputFormat::text:
+    break;
+  }
+  return OutputLayout();
+}
+
+double average_token_bytes(const Charset &charset, size_t length) {
+  return static_cast<double>(length) *
+         static_cast<double>(charset.total_bytes()) /
+         static_cast<double>(charset.size());
+}
+
+double estimate_output_bytes(double token_bytes, uint64_t count,
+                             OutputFormat format) {
+  if (format == OutputFormat::jsonl) {
+    token_bytes += 2;
+  } else if (format == OutputFormat::binary) {
+    token_bytes += FramedTokens<CharsetTokens>::LENGTH_PREFIX;
+  }
+  // 分隔符：count - 1 个空格或换行，加上末尾换行
+  return (token_bytes + 1) * static_cast<double>(count);
+}
+
+char *write_json_escaped(const char *data, size_t size, char *out) {
+  static constexpr char HEX[] = "0123456789abcdef";
+  for (size_t i = 0; i < size; ++i) {
+    unsigned char c = static_cast<unsigned char>(data[i]);
+    if (!escape_tables.json[c]) {
+      *out++ = static_cast<char>(c);
+      continue;
+    }
+    *out++ = '\\';
+    switch (c) {
+    case '"':
+    case '\\':
+      *out++ = static_cast<char>(c);
+      break;
+    case '\n':
+      *out++ = 'n';
+      break;
+    case '\r':
+      *out++ = 'r';
+      break;
+    case '\t':
+      *out++ = 't';
+      break;
+    default:
+      out[0] = 'u';
+      out[1] = '0';
+      out[2] = '0';
+      out[3] = HEX[c >> 4];
+      out[4] = HEX[c & 0xF];
+      out += 5;
+      break;
+    }
+  }
+  return out;
+}
+
+char *write_csv_quoted(const char *data, size_t size, char *out) {
+  *out++ = '"';
+  for (size_t i = 0; i < size; ++i) {
+    if (data[i] == '"') {
+      *out++ = '"';
+    }
+    *out++ = data[i];
+  }
+  *out++ = '"';
+  return out;
+}
+
+// 将 UTF-8 字符串拆分为单个字符（字符串向量）
+std::vector<std::string> split_utf8_string(const std::string_view &str) {
+  std::vector<std::string> chars;
+  for (size_t i = 0; i < str.length();) {
+    unsigned char c = static_cast<unsigned char>(str[i]);
+    size_t n = 1;
+
+    // 根据 UTF-8 首字节判断字符长度
+    if ((c & 0x80) == 0)
+      n = 1; // ASCII
+    else if ((c & 0xE0) == 0xC0)
+      n = 2; // 2字节字符
+    else if ((c & 0xF0) == 0xE0)
+      n = 3; // 3字节字符 (汉字通常在这里)
+    else if ((c & 0xF8) == 0xF0)
+      n = 4; // 4字节字符
+
+    // 边界检查，防止非法 UTF-8 导致越界
+    if (i + n > str.length())
+      n = 1;
+
+    chars.emplace_back(str.substr(i, n));
+    i += n;
+  }
+  return chars;
+}
+
+Charset::Charset(const std::vector<std::string> &chars)
+    : size_(chars.size()) {
+  size_t total = 0;
+  for (const auto &ch : chars) {
+    total += ch.size();
+    max_width_ = std::max(max_width_, ch.size());
+  }
+  bytes_.reserve(total);
+  offsets_.reserve(chars.size() + 1);
+  bool uniform = true;
+  for (const auto &ch : chars) {
+    offsets_.push_back(static_cast<uint32_t>(bytes_.size()));
+    bytes_ += ch;
+    uniform = uniform && ch.size() == max_width_;
+  }
+  offsets_.push_back(static_cast<uint32_t>(bytes_.size()));
+  if (uniform) {
+    width_ = max_width_;
+    offsets_.clear(); // 等宽时不需要偏移数组
+    offsets_.shrink_to_fit();
+  }
+}
+
+Charset::Charset(const std::vector<uint64_t> &packed) : size_(packed.size()) {
+  size_t total = 0;
+  for (PackedChar ch : packed) {
+    total += packed_char_length(ch);
+    max_width_ = std::max(max_width_, packed_char_length(ch));
+  }
+  bytes_.resize(total);
+  offsets_.reserve(packed.size() + 1);
+  bool uniform = true;
+  size_t pos = 0;
+  for (PackedChar ch : packed) {
+    size_t n = packed_char_length(ch);
+    offsets_.push_back(static_cast<uint32_t>(pos));
+    for (size_t k = 0; k < n; ++k) {
+      bytes_[pos++] = static_cast<char>(ch >> (56 - 8 * k));
+    }
+    uniform = uniform && n == max_width_;
+  }
+  offsets_.push_back(static_cast<uint32_t>(pos));
+  if (uniform) {
+    width_ = max_width_;
+    offsets_.clear(); // 等宽时不需要偏移数组
+    offsets_.shrink_to_fit();
+  }
+}
+
+AliasTable::AliasTable(const std::vector<uint64_t> &weights)
+    : columns_(weights.size()) {
+  for (uint64_t w : weights) {
+    if (w == 0 || w > MAX_TOTAL_WEIGHT - total_) {
+      throw std::invalid_argument("权重须为正整数且总和不超过 " +
+                                  std::to_string(MAX_TOTAL_WEIGHT));
+    }
+    total_ += w;
+    max_weight_ = std::max(max_weight_, w);
+  }
+  // 每列的容量为 total：权重乘以 n 后，小于 total 的列用大列的余量补满
+  const uint64_t n = weights.size();
+  std::vector<uint64_t> scaled(weights.size());
+  std::vector<uint32_t> small, large;
+  small.reserve(weights.size());
+  large.reserve(weights.size());
+  for (size_t i = 0; i < weights.size(); ++i) {
+    scaled[i] = weights[i] * n;
+    (scaled[i] < total_ ? small : large).push_back(static_cast<uint32_t>(i));
+  }
+  while (!small.empty() && !large.empty()) {
+    uint32_t s = small.back();
+    uint32_t l = large.back();
+    small.pop_back();
+    columns_[s] = {static_cast<uint32_t>(scaled[s]), l};
+    scaled[l] -= total_ - scaled[s];
+    if (scaled[l] < total_) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+  // 剩下的列恰好满（整数运算无舍入误差）
+  for (uint32_t i : large) {
+    columns_[i] = {static_cast<uint32_t>(total_), i};
+  }
+  for (uint32_t i : small) {
+    columns_[i] = {static_cast<uint32_t>(total_), i};
+  }
+}
+
+void Charset::set_weights(const std::vector<uint64_t> &weights) {
+  if (weights.size() != size_) {
+    throw std::invalid_argument("权重个数与字符数不一致");
+  }
+  alias_ = std::make_shared<const AliasTable>(weights);
+}
+
+double Charset::bits_per_char() const {
+  if (alias_) {
+    return std::log2(static_cast<double>(alias_->total()) /
+                     static_cast<double>(alias_->max_weight()));
+  }
+  return std::log2(static_cast<double>(size_));
+}
+
+// 把一段已排序去重的字符追加到 chars 末尾，并与前面的部分归并去重
+static void merge_packed_run(std::vector<PackedChar> &chars,
+                             const PackedChar *run, size_t size) {
+  size_t middle = chars.size();
+  chars.insert(chars.end(), run, run + size);
+  std::inplace_merge(chars.begin(), chars.begin() + middle, chars.end());
+  chars.erase(std::unique(chars.begin(), chars.end()), chars.end());
+}
+
+// 运行时给出的字符（-c 或文件）：切分、排序去重后归并
+static void merge_packed_text(std::vector<PackedChar> &chars,
+                              std::string_view text) {
+  std::vector<PackedChar> run;
+  for_each_packed_char(text, [&run](PackedChar c) { run.push_back(c); });
+  std::sort(run.begin(), run.end());
+  run.erase(std::unique(run.begin(), run.end()), run.end());
+  merge_packed_run(chars, run.data(), run.size());
+}
+
+static const BuiltinCharset *find_builtin_charset(const std::string &name) {
+  for (const auto &builtin : builtin_charsets) {
+    if (builtin.name == name) {
+      return &builtin;
+    }
+  }
+  return nullptr;
+}
+
+Charset build_charset(const std::string &literal,
+                      const std::vector<std::string> &sources,
+                      const CharsetFileLoader &load_file,
+                      std::vector<std::string> *warnings) {
+  // 内置字符集在编译期已切分、排序、去重（charSet.hpp），这里只做归并；
+  // 全程按打包整数处理，不为每个字符分配字符串
+  std::vector<PackedChar> chars;
+
+  if (sources.empty() && literal.empty()) {
+    // 默认字符集：数字 + 大小写英文字母
+    merge_packed_run(chars, digit_table.chars.data(), digit_table.size);
+    merge_packed_run(chars, en_table.chars.data(), en_table.size);
+  } else {
+    merge_packed_text(chars, literal);
+
+    for (const auto &source : sources) {
+      if (const BuiltinCharset *builtin = find_builtin_charset(source)) {
+        merge_packed_run(chars, builtin->chars, builtin->size);
+        continue;
+      }
+      try {
+        std::vector<PackedChar> run = load_file(source);
+        merge_packed_run(chars, run.data(), run.size());
+      } catch (const std::exception &e) {
+        if (warnings != nullptr) {
+          warnings->emplace_back(e.what());
+        }
+      }
+    }
+  }
+
+  if (chars.empty()) {
+    throw std::runtime_error("有效字符集为空。");
+  }
+
+  // 转换为紧凑的连续字符表
+  return Charset(chars);
+}
+
+Charset build_charset(const std::string &literal,
+                      const std::vector<std::string> &sources,
+                      std::vector<std::string> *warnings,
+                      CharsetBuildStats *stats) {
+  using clock = std::chrono::steady_clock;
+  const clock::time_point start = stats ? clock::now() : clock::time_point{};
+  clock::duration load_time{};
+
+  Charset charset = build_charset(
+      literal, sources,
+      [&](const std::string &path) {
+        const clock::time_point load_start =
+            stats ? clock::now() : clock::time_point{};
+        CharsetFileInfo info;
+        std::vector<PackedChar> run = load_charset_file_packed(path, &info);
+        if (stats) {
+          load_time += clock::now() - load_start;
+          stats->loaded_bytes += info.bytes;
+          stats->loaded_chars += info.chars;
+          stats->loaded_unique += run.size();
+        }
+        return run;
+      },
+      warnings);
+  if (stats) {
+    stats->load_seconds = std::chrono::duration<double>(load_time).count();
+    stats->merge_seconds =
+        std::chrono::duration<double>(clock::now() - start - load_time)
+            .count();
+  }
+  return charset;
+}
+
+IndexSampler::IndexSampler(uint64_t n) : n_(n) {
+  if (n_ <= 1) {
+    return; // 只有一个字符，无需消耗熵
+  }
+  // 在所有 n^k <= 2^64 的 k 中，选每个 64 位字期望产出索引最多的一个
+  double best = 0;
+  uint64_t product = 1;
+  for (unsigned k = 1; k <= MAX_BATCH; ++k) {
+    uint64_t threshold;
+    if (product <= UINT64_MAX / n_) {
+      product *= n_;
+      threshold = (0 - product) % product; // 2^64 mod n^k
+    } else if ((n_ & (n_ - 1)) == 0 && product == UINT64_MAX / n_ + 1) {
+      product = 0; // n^k 恰为 2^64：取高位即可，永不拒绝
+      threshold = 0;
+    } else {
+      break;
+    }
+    double accept = 1.0 - std::ldexp(static_cast<double>(threshold), -64);
+    if (k * accept >= best) {
+      best = k * accept;
+      batch_ = k;
+      threshold_ = threshold;
+    }
+    if (product == 0) {
+      break;
+    }
+  }
+}
+
+// ---------------------------------------------------------------------------
+// 小型 ASCII 字符集的向量化内核
+// ---------------------------------------------------------------------------
+
+inline size_t ascii_kernel_scalar(const unsigned char *random, size_t size,
+                                  unsigned char *out,
+                                  const AsciiTable &table) {
+  size_t produced = 0;
+  for (size_t i = 0; i < size; ++i) {
+    unsigned v = random[i] & table.mask;
+    out[produced] = table.symbols[v];
+    produced += v < table.size; // 无分支拒绝
+  }
+  return produced;
+}
+
+#ifdef STR_RANDOM_X86
+// 压缩查找表：8 位接受掩码 -> 被接受字节的位置（按顺序排在低位）
+inline const uint64_t *ascii_compact_lut() {
+  static const auto lut = [] {
+    std::array<uint64_t, 256> table{};
+    for (unsigned mask = 0; mask < 256; ++mask) {
+      uint64_t positions = 0;
+      unsigned k = 0;
+      for (unsigned bit = 0; bit < 8; ++bit) {
+        if (mask & (1u << bit)) {
+          positions |= static_cast<uint64_t>(bit) << (8 * k++);
+        }
+      }
+      table[mask] = positions;
+    }
+    return table;
+  }();
+  return lut.data();
+}
+
+// 把 16 个候选字节中被 accept 选中的按顺序写到 out，返回写入个数
+__attribute__((target("ssse3"))) inline size_t
+ascii_compact16(__m128i symbols, unsigned accept, unsigned char *out) {
+  const uint64_t *lut = ascii_compact_lut();
+  __m128i shuffle = _mm_set_epi64x(
+      static_cast<long long>(lut[accept >> 8] + 0x0808080808080808ULL),
+      static_cast<long long>(lut[accept & 0xFF]));
+  __m128i packed = _mm_shuffle_epi8(symbols, shuffle);
+  size_t low = static_cast<size_t>(__builtin_popcount(accept & 0xFF));
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(out), packed);
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(out + low),
+                   _mm_unpackhi_epi64(packed, packed));
+  return low + static_cast<size_t>(__builtin_popcount(accept >> 8));
+}
+
+// 16 个 [0, 128) 的索引查表：低 4 位在子表内寻址，高 3 位选择子表
+__attribute__((target("ssse3"))) inline __m128i
+ascii_lookup16(__m128i index, const __m128i *sub, unsigned subtables) {
+  const __m128i low_nibble = _mm_set1_epi8(0x0F);
+  __m128i lo = _mm_and_si128(index, low_nibble);
+  __m128i hi = _mm_and_si128(_mm_srli_epi16(index, 4), low_nibble);
+  __m128i symbols = _mm_setzero_si128();
+  for (unsigned t = 0; t < subtables; ++t) {
+    __m128i hit = _mm_cmpeq_epi8(hi, _mm_set1_epi8(static_cast<char>(t)));
+    symbols =
+        _mm_or_si128(symbols, _mm_and_si128(_mm_shuffle_epi8(sub[t], lo), hit));
+  }
+  return symbols;
+}
+
+// SSSE3：每次 16 字节，用 pshufb 在 8 张 16 项子表中查找
+__attribute__((target("ssse3"))) inline size_t
+ascii_kernel_ssse3(const unsigned char *random, size_t size, unsigned char *out,
+                   const AsciiTable &table) {
+  const __m128i mask = _mm_set1_epi8(static_cast<char>(table.mask));
+  const __m128i limit = _mm_set1_epi8(static_cast<char>(table.size - 1));
+  const unsigned subtables = (table.size + 15) / 16;
+  __m128i sub[8];
+  for (unsigned t = 0; t < 8; ++t) {
+    sub[t] = _mm_load_si128(
+        reinterpret_cast<const __m128i *>(table.symbols + 16 * t));
+  }
+
+  size_t produced = 0;
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i v = _mm_and_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(random + i)), mask);
+    __m128i symbols = ascii_lookup16(v, sub, subtables);
+    // v <= size - 1（v 与 size - 1 均不超过 127，可用有符号比较）
+    unsigned accept = static_cast<unsigned>(
+        _mm_movemask_epi8(_mm_cmpgt_epi8(v, limit)) ^ 0xFFFF);
+    produced += ascii_compact16(symbols, accept, out + produced);
+  }
+  return produced +
+         ascii_kernel_scalar(random + i, size - i, out + produced, table);
+}
+
+// AVX2：每次 32 字节
+__attribute__((target("avx2"))) inline size_t
+ascii_kernel_avx2(const unsigned char *random, size_t size, unsigned char *out,
+                  const AsciiTable &table) {
+  const __m256i mask = _mm256_set1_epi8(static_cast<char>(table.mask));
+  const __m256i low_nibble = _mm256_set1_epi8(0x0F);
+  const __m256i limit = _mm256_set1_epi8(static_cast<char>(table.size - 1));
+  const unsigned subtables = (table.size + 15) / 16;
+  __m256i sub[8];
+  for (unsigned t = 0; t < 8; ++t) {
+    sub[t] = _mm256_broadcastsi128_si256(_mm_load_si128(
+        reinterpret_cast<const __m128i *>(table.symbols + 16 * t)));
+  }
+
+  size_t produced = 0;
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i v = _mm256_and_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(random + i)),
+        mask);
+    __m256i lo = _mm256_and_si256(v, low_nibble);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibble);
+    __m256i symbols = _mm256_setzero_si256();
+    for (unsigned t = 0; t < subtables; ++t) {
+      __m256i hit =
+          _mm256_cmpeq_epi8(hi, _mm256_set1_epi8(static_cast<char>(t)));
+      symbols = _mm256_or_si256(
+          symbols, _mm256_and_si256(_mm256_shuffle_epi8(sub[t], lo), hit));
+    }
+    unsigned accept = ~static_cast<unsigned>(
+        _mm256_movemask_epi8(_mm256_cmpgt_epi8(v, limit)));
+    produced += ascii_compact16(_mm256_castsi256_si128(symbols),
+                                accept & 0xFFFF, out + produced);
+    produced += ascii_compact16(_mm256_extracti128_si256(symbols, 1),
+                                accept >> 16, out + produced);
+  }
+  return produced +
+         ascii_kernel_scalar(random + i, size - i, out + produced, table);
+}
+#endif // STR_RANDOM_X86
+
+// ---------------------------------------------------------------------------
+// 2 的幂单字节字符集的位切片内核
+// ---------------------------------------------------------------------------
+
+inline void pow2_kernel_scalar(const unsigned char *random, size_t symbols,
+                               unsigned bits, unsigned char *out,
+                               const AsciiTable &table) {
+  const uint64_t mask = (uint64_t{1} << bits) - 1;
+  for (size_t i = 0; i < symbols; ++i) {
+    size_t bit = i * bits;
+    uint64_t word;
+    std::memcpy(&word, random + bit / 8, sizeof(word));
+    out[i] = table.symbols[(word >> (bit % 8)) & mask];
+  }
+}
+
+#ifdef STR_RANDOM_X86
+// BMI2 + SSSE3：8 个字符恰好占 b 个字节，一条 pdep 把它们展开到 8 个字节
+// 的低 b 位，两次 pdep 得到 16 个索引后用 pshufb 查表
+__attribute__((target("bmi2,ssse3"))) inline void
+pow2_kernel_bmi2(const unsigned char *random, size_t symbols, unsigned bits,
+                 unsigned char *out, const AsciiTable &table) {
+  const uint64_t deposit =
+      0x0101010101010101ULL * ((uint64_t{1} << bits) - 1);
+  const unsigned subtables = (table.size + 15) / 16;
+  __m128i sub[8];
+  for (unsigned t = 0; t < 8; ++t) {
+    sub[t] = _mm_load_si128(
+        reinterpret_cast<const __m128i *>(table.symbols + 16 * t));
+  }
+
+  size_t i = 0;
+  for (; i + 16 <= symbols; i += 16) {
+    const unsigned char *p = random + i / 8 * bits;
+    uint64_t lo, hi;
+    std::memcpy(&lo, p, sizeof(lo));
+    std::memcpy(&hi, p + bits, sizeof(hi));
+    __m128i index =
+        _mm_set_epi64x(static_cast<long long>(_pdep_u64(hi, deposit)),
+                       static_cast<long long>(_pdep_u64(lo, deposit)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     ascii_lookup16(index, sub, subtables));
+  }
+  pow2_kernel_scalar(random + i / 8 * bits, symbols - i, bits, out + i, table);
+}
+#endif // STR_RANDOM_X86
+
+std::vector<Pow2KernelInfo> pow2_kernels() {
+  std::vector<Pow2KernelInfo> kernels;
+#ifdef STR_RANDOM_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("bmi2") && __builtin_cpu_supports("ssse3")) {
+    kernels.push_back({pow2_kernel_bmi2, "pow2-bmi2"});
+  }
+#endif
+  kernels.push_back({pow2_kernel_scalar, "pow2-scalar"});
+  return kernels;
+}
+
+const Pow2KernelInfo &pow2_kernel() {
+  static const Pow2KernelInfo info = pow2_kernels().front();
+  return info;
+}
+
+std::vector<AsciiKernelInfo> ascii_kernels() {
+  std::vector<AsciiKernelInfo> kernels;
+#ifdef STR_RANDOM_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back({ascii_kernel_avx2, "ascii-avx2"});
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    kernels.push_back({ascii_kernel_ssse3, "ascii-ssse3"});
+  }
+#endif
+  kernels.push_back({ascii_kernel_scalar, "ascii-scalar"});
+  return kernels;
+}
+
+const AsciiKernelInfo &ascii_kernel() {
+  static const AsciiKernelInfo info = ascii_kernels().front();
+  return info;
+}
+
+SamplingPath select_sampling_path(const Charset &charset) {
+  if (charset.alias() != nullptr) {
+    return SamplingPath::alias;
+  }
+  size_t n = charset.size();
+  if (n >= 2 && (n & (n - 1)) == 0 && n <= (size_t{1} << 32)) {
+    return SamplingPath::pow2;
+  }
+  if (charset.width() == 1 && n > 1 && n <= 128) {
+    return SamplingPath::ascii_simd;
+  }
+  return SamplingPath::lemire;
+}
+
+CharsetSampler::CharsetSampler(const Charset &charset)
+    : charset_(charset), sampler_(charset.size()),
+      coin_(charset.alias() ? charset.alias()->total() : 1),
+      path_(select_sampling_path(charset)) {
+  if (path_ == SamplingPath::pow2) {
+    while ((size_t{1} << pow2_bits_) < charset.size()) {
+      ++pow2_bits_;
+    }
+    pow2_per_word_ = 64 / pow2_bits_;
+  }
+  // 单字节字符集（2 的幂时走位切片内核）批量生成到字符缓冲
+  if (path_ != SamplingPath::alias && charset.width() == 1 &&
+      charset.size() > 1 && charset.size() <= 128) {
+    ascii_ = std::make_unique<AsciiState>();
+    AsciiTable &table = ascii_->table;
+    table.size = static_cast<unsigned>(charset.size());
+    unsigned mask = 1;
+    while (mask < table.size) {
+      mask <<= 1;
+    }
+    table.mask = static_cast<unsigned char>(mask - 1);
+    std::memcpy(table.symbols, charset.data(), charset.size());
+  }
+}
+
+CharsetSampler::~CharsetSampler() {
+  uint64_t entropy =
+      (sampler_.words_drawn() + coin_.words_drawn() + pow2_words_) * 8;
+  secure_wipe(&pow2_buffer_, sizeof(pow2_buffer_));
+  secure_wipe(pow2_batch_, sizeof(pow2_batch_));
+  uint64_t rejections = sampler_.rejections() + coin_.rejections();
+  if (ascii_) {
+    secure_wipe(ascii_->symbols, sizeof(ascii_->symbols));
+    entropy += ascii_->random_bytes;
+    rejections += ascii_->random_bytes - ascii_->produced;
+  }
+  total_entropy_counter().fetch_add(entropy, std::memory_order_relaxed);
+  total_rejections_counter().fetch_add(rejections,
+                                       std::memory_order_relaxed);
+}
+
+void CharsetSampler::discard() {
+  sampler_.discard();
+  coin_.discard();
+  secure_wipe(&pow2_buffer_, sizeof(pow2_buffer_));
+  pow2_left_ = 0;
+  secure_wipe(pow2_batch_, sizeof(pow2_batch_));
+  pow2_batch_pos_ = POW2_BATCH;
+  if (ascii_) {
+    secure_wipe(ascii_->symbols, sizeof(ascii_->symbols));
+    ascii_->pos = ascii_->count = 0;
+  }
+}
+
+const char *CharsetSampler::path_name() const {
+  switch (path_) {
+  case SamplingPath::ascii_simd:
+    return ascii_kernel().name;
+  case SamplingPath::pow2:
+    return ascii_ ? pow2_kernel().name : "pow2-bitslice";
+  case SamplingPath::alias:
+    return "alias";
+  case SamplingPath::lemire:
+    break;
+  }
+  return "lemire";
+}
+
+std::atomic<uint64_t> &CharsetSampler::total_entropy_counter() {
+  static std::atomic<uint64_t> counter{0};
+  return counter;
+}
+std::atomic<uint64_t> &CharsetSampler::total_rejections_counter() {
+  static std::atomic<uint64_t> counter{0};
+  return counter;
+}
+
+// ---------------------------------------------------------------------------
+// RDRAND / RDSEED
+// ---------------------------------------------------------------------------
+
+namespace {
+
+// Intel DRNG 软件实现指南：RDRAND 连续失败 10 次即可认为硬件故障；RDSEED
+// 在熵源补满之前会正常地失败，pause 后继续尝试
+constexpr int RDRAND_RETRIES = 10;
+constexpr int RDSEED_RETRIES = 1000;
+constexpr size_t SELF_TEST_WORDS = 16;
+
+#ifdef STR_RANDOM_RDRAND
+bool cpu_has_instruction(HardwareInstruction instruction) {
+  unsigned eax, ebx, ecx, edx;
+  if (instruction == HardwareInstruction::rdrand) {
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_RDRND) != 0;
+  }
+  return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+         (ebx & bit_RDSEED) != 0;
+}
+
+__attribute__((target("rdrnd"))) bool rdrand_words(uint64_t *words,
+                                                   size_t count,
+                                                   uint64_t &retries) {
+  for (size_t i = 0; i < count; ++i) {
+    unsigned long long value;
+    for (int tries = 0; !_rdrand64_step(&value); ++tries) {
+      ++retries;
+      if (tries + 1 >= RDRAND_RETRIES) {
+        return false;
+      }
+    }
+    words[i] = value;
+  }
+  return true;
+}
+
+__attribute__((target("rdseed"))) bool rdseed_words(uint64_t *words,
+                                                   size_t count,
+                                                   uint64_t &retries) {
+  for (size_t i = 0; i < count; ++i) {
+    unsigned long long value;
+    for (int tries = 0; !_rdseed64_step(&value); ++tries) {
+      ++retries;
+      if (tries + 1 >= RDSEED_RETRIES) {
+        return false;
+      }
+      _mm_pause();
+    }
+    words[i] = value;
+  }
+  return true;
+}
+#endif // STR_RANDOM_RDRAND
+
+const char *instruction_name(HardwareInstruction instruction) {
+  return instruction == HardwareInstruction::rdrand ? "RDRAND" : "RDSEED";
+}
+
+// 相邻两个输出相同即视为卡死
+bool repeats(const uint64_t *words, size_t count) {
+  for (size_t i = 1; i < count; ++i) {
+    if (words[i] == words[i - 1]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *probe_instruction(HardwareInstruction instruction) {
+#ifdef STR_RANDOM_RDRAND
+  if (!cpu_has_instruction(instruction)) {
+    return "CPU 不支持该指令";
+  }
+  uint64_t words[SELF_TEST_WORDS];
+  const char *reason = nullptr;
+  if (!hardware_random_words(instruction, words, SELF_TEST_WORDS)) {
+    reason = "启动自检失败：指令持续返回失败";
+  } else if (repeats(words, SELF_TEST_WORDS)) {
+    reason = "启动自检失败：输出卡死";
+  }
+  secure_wipe(words, sizeof(words));
+  return reason;
+#else
+  (void)instruction;
+  return "当前平台没有该指令";
+#endif
+}
+
+} // namespace
+
+const char *hardware_random_unavailable(HardwareInstruction instruction) {
+  static const char *const rdrand = probe_instruction(HardwareInstruction::rdrand);
+  static const char *const rdseed = probe_instruction(HardwareInstruction::rdseed);
+  return instruction == HardwareInstruction::rdrand ? rdrand : rdseed;
+}
+
+bool hardware_random_words(HardwareInstruction instruction, uint64_t *words,
+                           size_t count) {
+#ifdef STR_RANDOM_RDRAND
+  uint64_t retries = 0;
+  bool ok = instruction == HardwareInstruction::rdrand
+                ? rdrand_words(words, count, retries)
+                : rdseed_words(words, count, retries);
+  if (retries > 0) {
+    HardwareRandomGenerator::retry_counter().fetch_add(
+        retries, std::memory_order_relaxed);
+  }
+  return ok;
+#else
+  (void)instruction;
+  (void)words;
+  (void)count;
+  return false;
+#endif
+}
+
+std::atomic<uint64_t> &HardwareRandomGenerator::retry_counter() {
+  static std::atomic<uint64_t> counter{0};
+  return counter;
+}
+
+void HardwareRandomGenerator::refill() {
+  if (!hardware_) {
+    kernel_.fill(buffer_, BUFFER_BYTES);
+    pos_ = 0;
+    return;
+  }
+  uint64_t words[BUFFER_WORDS];
+  if (!hardware_random_words(instruction_, words, BUFFER_WORDS)) {
+    secure_wipe(words, sizeof(words));
+    throw std::runtime_error(std::string(instruction_name(instruction_)) +
+                             " 重试后仍然失败，硬件熵源不可用");
+  }
+  // 持续健康检测：与上一批的最后一个输出也要比较
+  bool stuck = repeats(words, BUFFER_WORDS) || (has_last_ && words[0] == last_);
+  last_ = words[BUFFER_WORDS - 1];
+  has_last_ = true;
+  if (stuck) {
+    secure_wipe(words, sizeof(words));
+    throw std::runtime_error(std::string(instruction_name(instruction_)) +
+                             " 健康检查失败：连续输出相同的 64 位值");
+  }
+  std::memcpy(buffer_, words, BUFFER_BYTES);
+  secure_wipe(words, sizeof(words));
+  if (mix_kernel_) {
+    unsigned char kernel[BUFFER_BYTES];
+    kernel_.fill(kernel, BUFFER_BYTES);
+    for (size_t i = 0; i < BUFFER_BYTES; ++i) {
+      buffer_[i] ^= kernel[i];
+    }
+    secure_wipe(kernel, sizeof(kernel));
+  }
+  pos_ = 0;
+}
+
+// ---------------------------------------------------------------------------
+// TokenGenerator
+// ---------------------------------------------------------------------------
+
+struct TokenGenerator::Impl {
+  using Engine = std::variant<SystemRandomGenerator, ChaCha20Generator,
+                              HardwareRandomGenerator>;
+
+  Impl(Charset charset_, EngineKind kind)
+      : charset(std::move(charset_)), engine(make_engine(kind)),
+        sampler(charset) {}
+
+  static Engine make_engine(EngineKind kind) {
+    if (kind == EngineKind::chacha20) {
+      return Engine(std::in_place_type<ChaCha20Generator>);
+    }
+    if (kind == EngineKind::rdrand || kind == EngineKind::rdseed) {
+      return Engine(std::in_place_type<HardwareRandomGenerator>,
+                    kind == EngineKind::rdrand ? HardwareInstruction::rdrand
+                                               : HardwareInstruction::rdseed);
+    }
+    return Engine(std::in_place_type<SystemRandomGenerator>);
+  }
+
+  Charset charset; // 必须先于 sampler 构造：sampler 持有它的引用
+  Engine engine;
+  CharsetSampler sampler;
+};
+
+TokenGenerator::TokenGenerator(Charset charset, EngineKind engine)
+    : impl_(std::make_unique<Impl>(std::move(charset), engine)) {}
+
+TokenGenerator::~TokenGenerator() = default;
+TokenGenerator::TokenGenerator(TokenGenerator &&) noexcept = default;
+TokenGenerator &TokenGenerator::operator=(TokenGenerator &&) noexcept = default;
+
+const Charset &TokenGenerator::charset() const { return impl_->charset; }
+
+size_t TokenGenerator::generate_into(OutputSpan out, size_t length) {
+  return std::visit(
+      [&](auto &generator) {
+        return randomstr::generate_into(out, length, impl_->sampler,
+                                        generator);
+      },
+      impl_->engine);
+}
+
+size_t TokenGenerator::generate_batch_into(OutputSpan out, size_t length,
+                                           size_t count, char separator) {
+  return std::visit(
+      [&](auto &generator) {
+        return randomstr::generate_batch_into(out, length, count, separator,
+                                              impl_->sampler, generator);
+      },
+      impl_->engine);
+}
+
+} // namespace randomstr
@@ -0,0 +1,2436 @@
+// librandomstr：密码学安全随机字符串生成库
+//
+// 提供字符集构建（Charset / build_charset）、随机数引擎（SystemRandomGenerator、
+// ChaCha20Generator、HardwareRandomGenerator；测试数据用的可复现引擎
+// Xoshiro256Generator）与无偏采样
+// （CharsetSampler），以及把随机字符串直接写入调用者缓冲区（OutputSpan）的
+// 接口：发放令牌的路径上不做任何堆分配。
+// 命令行工具 str_random.cc 只是这个库的一个使用者。
+#ifndef RANDOMSTR_HPP
+#define RANDOMSTR_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace randomstr {
+
+// 安全擦除内存：写零后加编译器屏障（或通过 volatile 指针逐字节写零），
+// 避免被编译器当作死存储优化掉
+inline void secure_wipe(void *data, size_t size) {
+#if defined(__GNUC__)
+  std::memset(data, 0, size);
+  __asm__ __volatile__("" : : "r"(data) : "memory");
+#else
+  volatile unsigned char *p = static_cast<volatile unsigned char *>(data);
+  while (size--) {
+    *p++ = 0;
+  }
+#endif
+}
+
+// fork 代数：每次 fork 后在子进程中递增。持有熵缓冲的生成器记录填充时的代数，
+// 不一致时说明缓冲是从父进程继承来的，必须丢弃
+uint64_t current_fork_generation();
+
+// 使用系统调用获取密码学安全的随机数（Linux: getrandom/urandom；Windows:
+// BCryptGenRandom）
+//
+// 池化模式（pool_size > 0）下，一次系统调用填满整个熵池，后续抽取直接从池中
+// 取字节，取走的字节立即擦除；fork 之后子进程会丢弃继承来的熵池，避免父子进程
+// 输出相同的随机数。pool_size == 0 时退回到每次抽取一次系统调用。
+class SystemRandomGenerator {
+public:
+  using result_type = uint64_t;
+
+  static constexpr size_t DEFAULT_POOL_SIZE = 4096; // 4 KB
+
+  explicit SystemRandomGenerator(size_t pool_size = DEFAULT_POOL_SIZE)
+      : pool_(pool_size), pos_(pool_size),
+        fork_generation_(current_fork_generation()) {}
+
+  ~SystemRandomGenerator() { secure_wipe(pool_.data(), pool_.size()); }
+
+  // 熵池中是密钥材料，禁止复制；允许移动（被移走的对象池为空）
+  SystemRandomGenerator(const SystemRandomGenerator &) = delete;
+  SystemRandomGenerator &operator=(const SystemRandomGenerator &) = delete;
+  SystemRandomGenerator(SystemRandomGenerator &&other) noexcept
+      : pool_(std::move(other.pool_)), pos_(other.pos_),
+        fork_generation_(other.fork_generation_) {
+    other.pool_.clear();
+    other.pos_ = 0;
+  }
+
+  template <typename T = uint64_t> T operator()() {
+    T value{};
+    fill(reinterpret_cast<unsigned char *>(&value), sizeof(T));
+    return value;
+  }
+
+  // 批量获取随机字节
+  void fill(unsigned char *buffer, size_t size) {
+    if (pool_.empty()) {
+      fill_random_bytes(buffer, size);
+      return;
+    }
+    if (fork_generation_ != current_fork_generation()) {
+      discard_pool(); // fork 后的子进程不得复用父进程的熵
+    }
+    while (size > 0) {
+      if (pos_ == pool_.size()) {
+        refill();
+      }
+      size_t n = std::min(size, pool_.size() - pos_);
+      std::memcpy(buffer, pool_.data() + pos_, n);
+      secure_wipe(pool_.data() + pos_, n); // 取走即擦除
+      pos_ += n;
+      buffer += n;
+      size -= n;
+    }
+  }
+
+  size_t pool_size() const { return pool_.size(); }
+
+  static constexpr uint64_t min() { return 0; }
+  static constexpr uint64_t max() { return UINT64_MAX; }
+
+  // 进程内所有实例累计的系统调用次数与获取的熵字节数
+  static uint64_t syscall_count() {
+    return syscall_counter().load(std::memory_order_relaxed);
+  }
+  static uint64_t entropy_bytes() {
+    return entropy_counter().load(std::memory_order_relaxed);
+  }
+
+  // 开启后累计熵系统调用的墙钟耗时（--stats）；关闭时每次调用只多一次判断
+  static void enable_timing() {
+    timing_enabled().store(true, std::memory_order_relaxed);
+  }
+  static double syscall_seconds() {
+    return syscall_nanoseconds().load(std::memory_order_relaxed) / 1e9;
+  }
+
+private:
+  std::vector<unsigned char> pool_;
+  size_t pos_;                   // 池中下一个未使用字节的位置
+  uint64_t fork_generation_ = 0; // 填充熵池时的 fork 代数
+
+  static std::atomic<uint64_t> &syscall_counter();
+  static std::atomic<uint64_t> &entropy_counter();
+  static std::atomic<bool> &timing_enabled();
+  static std::atomic<uint64_t> &syscall_nanoseconds();
+
+  void refill() {
+    fork_generation_ = current_fork_generation();
+    fill_random_bytes(pool_.data(), pool_.size());
+    pos_ = 0;
+  }
+
+  void discard_pool() {
+    secure_wipe(pool_.data(), pool_.size());
+    pos_ = pool_.size();
+  }
+
+  // 先尝试 getrandom；若内核不支持则回落到 /dev/urandom；Windows 使用
+  // BCryptGenRandom
+  static void fill_random_bytes(unsigned char *buffer, size_t size);
+#ifndef _WIN32
+  static void fill_from_urandom(unsigned char *buffer, size_t size);
+#endif
+};
+
+// ---------------------------------------------------------------------------
+// ChaCha20 用户态 CSPRNG
+// ---------------------------------------------------------------------------
+
+// ChaCha20 块函数（RFC 7539 布局：input[12] 为 32 位块计数器，input[13..15]
+// 为 96 位 nonce）。连续生成 nblocks 个 64 字节块，第 i 块使用计数器
+// input[12] + i。
+using ChaCha20Kernel = void (*)(const uint32_t input[16], unsigned char *out,
+                                size_t nblocks);
+
+// 运行时按 CPU 特性选择内核
+struct ChaCha20KernelInfo {
+  ChaCha20Kernel kernel;
+  const char *name;
+};
+
+const ChaCha20KernelInfo &chacha20_kernel();
+
+// 当前 CPU 可用的全部内核，按优先级排列：第一个即 chacha20_kernel() 的
+// 选择，最后一个是标量参考实现（--selftest 逐一与之比对）
+std::vector<ChaCha20KernelInfo> chacha20_kernels();
+
+// 基于 ChaCha20 的 DRBG：种子（256 位密钥 + 96 位 nonce）通过
+// SystemRandomGenerator 取自 getrandom；每次批量生成 BLOCKS 个块，前 32 字节
+// 立即作为下一批的密钥并擦除（快速密钥擦除），其余字节对外输出，取走即擦除。
+// 每输出 reseed_interval 字节（0 表示不定期重播种）或检测到 fork 后，混入新的
+// 内核熵重新播种。
+class ChaCha20Generator {
+public:
+  using result_type = uint64_t;
+
+  static constexpr uint64_t DEFAULT_RESEED_INTERVAL = 16 * 1024 * 1024; // 16 MB
+
+  explicit ChaCha20Generator(
+      uint64_t reseed_interval = DEFAULT_RESEED_INTERVAL)
+      : reseed_interval_(reseed_interval) {
+    reseed();
+  }
+
+  ~ChaCha20Generator() {
+    secure_wipe(state_, sizeof(state_));
+    secure_wipe(buffer_, sizeof(buffer_));
+  }
+
+  ChaCha20Generator(const ChaCha20Generator &) = delete;
+  ChaCha20Generator &operator=(const ChaCha20Generator &) = delete;
+  ChaCha20Generator(ChaCha20Generator &&other) noexcept
+      : pos_(other.pos_), reseed_interval_(other.reseed_interval_),
+        bytes_since_seed_(other.bytes_since_seed_),
+        fork_generation_(other.fork_generation_),
+        needs_reseed_(other.needs_reseed_),
+        seeder_(std::move(other.seeder_)) {
+    std::memcpy(state_, other.state_, sizeof(state_));
+    std::memcpy(buffer_, other.buffer_, sizeof(buffer_));
+    // 被移走的对象不得再输出相同的流：清空状态并在下次使用时强制重播种
+    secure_wipe(other.state_, sizeof(other.state_));
+    secure_wipe(other.buffer_, sizeof(other.buffer_));
+    other.pos_ = BUFFER_SIZE;
+    other.needs_reseed_ = true;
+  }
+
+  template <typename T = uint64_t> T operator()() {
+    T value{};
+    fill(reinterpret_cast<unsigned char *>(&value), sizeof(T));
+    return value;
+  }
+
+  void fill(unsigned char *buffer, size_t size) {
+    if (fork_generation_ != current_fork_generation()) {
+      // fork 后丢弃继承的输出缓冲，并在 refill 中重新播种
+      secure_wipe(buffer_, sizeof(buffer_));
+      pos_ = BUFFER_SIZE;
+    }
+    while (size > 0) {
+      if (pos_ == BUFFER_SIZE) {
+        refill();
+      }
+      size_t n = std::min(size, BUFFER_SIZE - pos_);
+      std::memcpy(buffer, buffer_ + pos_, n);
+      secure_wipe(buffer_ + pos_, n);
+      pos_ += n;
+      buffer += n;
+      size -= n;
+    }
+  }
+
+  // 进程内所有实例累计的播种次数
+  static uint64_t reseed_count() {
+    return reseed_counter().load(std::memory_order_relaxed);
+  }
+  static const char *kernel_name() { return chacha20_kernel().name; }
+
+  static constexpr uint64_t min() { return 0; }
+  static constexpr uint64_t max() { return UINT64_MAX; }
+
+private:
+  static constexpr size_t BLOCKS = 64;
+  static constexpr size_t BUFFER_SIZE = BLOCKS * 64; // 4 KB
+  static constexpr size_t KEY_BYTES = 32;
+  static constexpr size_t NONCE_BYTES = 12;
+
+  alignas(32) uint32_t state_[16] = {};
+  alignas(32) unsigned char buffer_[BUFFER_SIZE] = {};
+  size_t pos_ = BUFFER_SIZE;
+  uint64_t reseed_interval_;
+  uint64_t bytes_since_seed_ = 0;
+  uint64_t fork_generation_ = 0;
+  // 状态已被清空（被移走），下次 refill 必须先播种，与 reseed_interval_ 无关
+  bool needs_reseed_ = false;
+  SystemRandomGenerator seeder_{0}; // 种子只取一次，无需熵池
+
+  static std::atomic<uint64_t> &reseed_counter();
+
+  void reseed();
+  void refill();
+};
+
+// ---------------------------------------------------------------------------
+// 硬件随机数引擎（x86 RDRAND / RDSEED）
+// ---------------------------------------------------------------------------
+
+enum class HardwareInstruction {
+  rdrand, // CPU 内置 DRBG 的输出，吞吐高
+  rdseed, // 直接来自熵源（经调理），更慢，熵不足时更常失败
+};
+
+// 指令不可用时返回原因（平台或 CPU 不支持、启动自检失败），可用时返回
+// nullptr。首次调用时用 cpuid 检测并做一次自检，结果在进程内缓存
+const char *hardware_random_unavailable(HardwareInstruction instruction);
+
+// 用指令填充 count 个 64 位随机数。进位标志为 0（暂时没有随机数）时按 Intel
+// 的建议重试：RDRAND 至多 10 次，RDSEED 每次先 pause，至多 1000 次；仍失败
+// 返回 false。调用者须先确认指令可用
+bool hardware_random_words(HardwareInstruction instruction, uint64_t *words,
+                           size_t count);
+
+// RDRAND / RDSEED 引擎：每次从指令批量取 BUFFER_WORDS 个 64 位数，取走即
+// 擦除，不经过系统调用。持续健康检测：相邻两个 64 位输出相同即视为熵源卡死
+// （正常情况下概率为 2^-64，如某些 CPU 固件缺陷下恒为全 1），抛出
+// std::runtime_error 而不是输出可疑的数据；指令重试后仍失败同样抛出异常。
+// 指令不可用时回退到 getrandom（SystemRandomGenerator）。mix_kernel 为 true
+// 时每批输出再与内核熵异或：两个来源相互独立，只要有一个可信，结果就不弱
+// 于它。
+class HardwareRandomGenerator {
+public:
+  using result_type = uint64_t;
+
+  static constexpr size_t BUFFER_WORDS = 64;
+
+  explicit HardwareRandomGenerator(
+      HardwareInstruction instruction = HardwareInstruction::rdrand,
+      bool mix_kernel = false,
+      size_t pool_size = SystemRandomGenerator::DEFAULT_POOL_SIZE)
+      : instruction_(instruction),
+        hardware_(hardware_random_unavailable(instruction) == nullptr),
+        mix_kernel_(mix_kernel), fork_generation_(current_fork_generation()),
+        kernel_(pool_size) {}
+
+  ~HardwareRandomGenerator() {
+    secure_wipe(buffer_, sizeof(buffer_));
+    secure_wipe(&last_, sizeof(last_));
+  }
+
+  HardwareRandomGenerator(const HardwareRandomGenerator &) = delete;
+  HardwareRandomGenerator &operator=(const HardwareRandomGenerator &) = delete;
+  HardwareRandomGenerator(HardwareRandomGenerator &&other) noexcept
+      : instruction_(other.instruction_), hardware_(other.hardware_),
+        mix_kernel_(other.mix_kernel_), pos_(other.pos_), last_(other.last_),
+        has_last_(other.has_last_), fork_generation_(other.fork_generation_),
+        kernel_(std::move(other.kernel_)) {
+    std::memcpy(buffer_, other.buffer_, sizeof(buffer_));
+    secure_wipe(other.buffer_, sizeof(other.buffer_));
+    other.pos_ = BUFFER_BYTES;
+  }
+
+  template <typename T = uint64_t> T operator()() {
+    T value{};
+    fill(reinterpret_cast<unsigned char *>(&value), sizeof(T));
+    return value;
+  }
+
+  void fill(unsigned char *buffer, size_t size) {
+    if (fork_generation_ != current_fork_generation()) {
+      // 缓冲中的随机数已被父进程持有，子进程不得再输出
+      secure_wipe(buffer_, sizeof(buffer_));
+      pos_ = BUFFER_BYTES;
+      fork_generation_ = current_fork_generation();
+    }
+    while (size > 0) {
+      if (pos_ == BUFFER_BYTES) {
+        refill();
+      }
+      size_t n = std::min(size, BUFFER_BYTES - pos_);
+      std::memcpy(buffer, buffer_ + pos_, n);
+      secure_wipe(buffer_ + pos_, n);
+      pos_ += n;
+      buffer += n;
+      size -= n;
+    }
+  }
+
+  // 是否真正使用硬件指令（false 表示已回退到 getrandom）
+  bool hardware() const { return hardware_; }
+
+  // 进程内所有实例累计的指令重试次数（进位标志为 0）
+  static uint64_t retry_count() {
+    return retry_counter().load(std::memory_order_relaxed);
+  }
+
+  static constexpr uint64_t min() { return 0; }
+  static constexpr uint64_t max() { return UINT64_MAX; }
+
+private:
+  static constexpr size_t BUFFER_BYTES = BUFFER_WORDS * 8;
+
+  HardwareInstruction instruction_;
+  bool hardware_;
+  bool mix_kernel_;
+  alignas(8) unsigned char buffer_[BUFFER_BYTES] = {};
+  size_t pos_ = BUFFER_BYTES;
+  uint64_t last_ = 0; // 健康检测用的上一个输出
+  bool has_last_ = false;
+  uint64_t fork_generation_;
+  SystemRandomGenerator kernel_; // 回退与混合用
+
+  friend bool hardware_random_words(HardwareInstruction, uint64_t *, size_t);
+  static std::atomic<uint64_t> &retry_counter();
+
+  void refill();
+};
+
+// ---------------------------------------------------------------------------
+// 可复现的非密码学引擎（--seed）
+// ---------------------------------------------------------------------------
+
+// xoshiro256**：由 64 位种子经 splitmix64 展开为 256 位状态。输出可预测，
+// 只能用于测试数据，不能用于密码、密钥或令牌。
+//
+// 输出按令牌序号划分为若干随机流：第 k 个流从种子状态跳跃 k 次（每次前进
+// 2^128 步）开始，各流互不重叠。输出函数在每个流的第一个令牌前调用
+// select_stream，并丢弃采样器中缓冲的随机数，因此无论线程数与输出方式如何，
+// 同一种子的输出都完全相同。
+class Xoshiro256Generator {
+public:
+  using result_type = uint64_t;
+
+  explicit Xoshiro256Generator(uint64_t seed);
+
+  uint64_t next() {
+    const uint64_t result = rotl(state_[1] * 5, 7) * 9;
+    const uint64_t t = state_[1] << 17;
+    state_[2] ^= state_[0];
+    state_[3] ^= state_[1];
+    state_[1] ^= state_[2];
+    state_[0] ^= state_[3];
+    state_[2] ^= t;
+    state_[3] = rotl(state_[3], 45);
+    return result;
+  }
+
+  template <typename T = uint64_t> T operator()() {
+    static_assert(sizeof(T) <= sizeof(uint64_t), "至多 64 位");
+    return static_cast<T>(next());
+  }
+
+  void fill(unsigned char *buffer, size_t size) {
+    for (; size >= 8; size -= 8, buffer += 8) {
+      uint64_t value = next();
+      std::memcpy(buffer, &value, 8);
+    }
+    if (size > 0) {
+      uint64_t value = next();
+      std::memcpy(buffer, &value, size);
+    }
+  }
+
+  // 定位到第 stream 个随机流的起点。从当前流向后跳跃，按递增顺序认领流的
+  // worker 只需跳过其他 worker 的流
+  void select_stream(uint64_t stream);
+
+  static constexpr uint64_t min() { return 0; }
+  static constexpr uint64_t max() { return UINT64_MAX; }
+
+private:
+  uint64_t seed_state_[4];   // 第 0 个流的起点
+  uint64_t stream_state_[4]; // 第 stream_ 个流的起点
+  uint64_t stream_ = 0;
+  uint64_t state_[4];
+
+  static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+  // state 前进 2^128 步（借用 state_ 迭代，完成后恢复）
+  void jump(uint64_t (&state)[4]);
+};
+
+// 引擎是否按随机流定位（Xoshiro256Generator）
+template <typename Generator, typename = void>
+struct is_stream_generator : std::false_type {};
+template <typename Generator>
+struct is_stream_generator<
+    Generator, std::void_t<decltype(std::declval<Generator &>().select_stream(
+                   uint64_t{}))>> : std::true_type {};
+
+// 每个随机流覆盖的令牌数：约 64 KB 输出，取 2 的幂。只由令牌最大长度决定，
+// 与线程数、输出方式无关
+inline uint64_t stream_tokens(size_t max_bytes) {
+  uint64_t tokens = 1;
+  while (tokens * 2 * (max_bytes + 1) <= 64 * 1024) {
+    tokens *= 2;
+  }
+  return tokens;
+}
+
+// 多线程与映射输出的块大小：可复现引擎下向上取整到随机流的整数倍，使每块
+// 都从流的起点开始
+template <typename Generator>
+uint64_t align_chunk_tokens(uint64_t chunk_tokens, size_t max_bytes) {
+  if constexpr (is_stream_generator<Generator>::value) {
+    uint64_t unit = stream_tokens(max_bytes);
+    return (chunk_tokens + unit - 1) / unit * unit;
+  } else {
+    (void)max_bytes;
+    return chunk_tokens;
+  }
+}
+
+// 在第 index 个令牌之前调用：可复现引擎在流的起点切换随机流，并让 writer
+// 丢弃上一个流中缓冲的随机数；其他引擎什么也不做
+template <typename Generator, typename Writer>
+void begin_token(Generator &generator, Writer &writer, uint64_t index,
+                 uint64_t stream_mask) {
+  if constexpr (is_stream_generator<Generator>::value) {
+    if ((index & stream_mask) == 0) {
+      generator.select_stream(index / (stream_mask + 1));
+      writer.discard();
+    }
+  } else {
+    (void)generator;
+    (void)writer;
+    (void)index;
+    (void)stream_mask;
+  }
+}
+
+// 输出端已关闭（EPIPE），生成应立即停止
+struct OutputClosed : std::runtime_error {
+  OutputClosed() : std::runtime_error("输出管道已关闭") {}
+};
+
+// 基于 write(2) 的大块缓冲输出：内存占用固定为一个缓冲区，处理部分写入与
+// EINTR；对端关闭时抛出 OutputClosed（需事先忽略 SIGPIPE）
+class OutputWriter {
+public:
+  static constexpr size_t DEFAULT_BUFFER_SIZE = 1024 * 1024; // 1 MB
+
+  explicit OutputWriter(int fd, size_t buffer_size = DEFAULT_BUFFER_SIZE)
+      : fd_(fd), buffer_(buffer_size > 0 ? buffer_size : 1) {}
+
+  OutputWriter(const OutputWriter &) = delete;
+  OutputWriter &operator=(const OutputWriter &) = delete;
+
+  void append(char c) {
+    if (used_ == buffer_.size()) {
+      flush();
+    }
+    buffer_[used_++] = c;
+  }
+
+  void append(const char *data, size_t size) {
+    if (size > buffer_.size() - used_) {
+      flush();
+      if (size >= buffer_.size()) {
+        write_all(data, size); // 超过缓冲区的大块直接写出
+        return;
+      }
+    }
+    std::memcpy(buffer_.data() + used_, data, size);
+    used_ += size;
+  }
+
+  void append(const std::string &str) { append(str.data(), str.size()); }
+
+  // 直接在缓冲区中预留 size 字节供调用者写入，写完后用 commit 确认实际长度
+  char *reserve(size_t size) {
+    if (size > buffer_.size() - used_) {
+      flush();
+      if (size > buffer_.size()) {
+        buffer_.resize(size); // 单个字符串超过缓冲区时扩容
+      }
+    }
+    return buffer_.data() + used_;
+  }
+
+  void commit(char *end) { used_ = static_cast<size_t>(end - buffer_.data()); }
+
+  // 先写出缓冲区中已有的内容，再把 data 整块直接写出（流水线的缓冲区）
+  void write_direct(const char *data, size_t size) {
+    flush();
+    write_all(data, size);
+  }
+
+  void flush() {
+    if (used_ > 0) {
+      write_all(buffer_.data(), used_);
+      used_ = 0;
+    }
+  }
+
+  uint64_t bytes_written() const { return bytes_written_; }
+  uint64_t write_calls() const { return write_calls_; }
+
+  // 开启后累计 write 的墙钟耗时（--stats）
+  void enable_timing() { timing_ = true; }
+  double write_seconds() const { return write_nanoseconds_ / 1e9; }
+
+private:
+  int fd_;
+  std::vector<char> buffer_;
+  size_t used_ = 0;
+  uint64_t bytes_written_ = 0;
+  uint64_t write_calls_ = 0;
+  bool timing_ = false;
+  uint64_t write_nanoseconds_ = 0;
+
+  void write_all(const char *data, size_t size);
+};
+
+// 将 UTF-8 字符串拆分为单个字符（字符串向量）
+std::vector<std::string> split_utf8_string(const std::string_view &str);
+
+// Vose 别名表：按整数权重采样，构建 O(n)，每次采样 O(1)（一次均匀列号加一次
+// 均匀硬币）。全程整数运算，第 i 项被选中的概率严格等于 weights[i] / total。
+class AliasTable {
+public:
+  // 硬币由 IndexSampler 抽取（32 位索引），总权重不能超过 2^32 - 1
+  static constexpr uint64_t MAX_TOTAL_WEIGHT = UINT32_MAX;
+
+  // weights 均为正整数且总和不超过 MAX_TOTAL_WEIGHT，否则抛出
+  // std::invalid_argument
+  explicit AliasTable(const std::vector<uint64_t> &weights);
+
+  size_t size() const { return columns_.size(); }
+  uint64_t total() const { return total_; }
+  uint64_t max_weight() const { return max_weight_; }
+
+  // column 为 [0, size) 的均匀随机数，coin 为 [0, total) 的均匀随机数
+  uint32_t pick(uint32_t column, uint32_t coin) const {
+    const Column &c = columns_[column];
+    return coin < c.keep ? column : c.alias;
+  }
+
+private:
+  struct Column {
+    uint32_t keep;  // coin 小于 keep 时取本列，否则取 alias
+    uint32_t alias;
+  };
+  std::vector<Column> columns_;
+  uint64_t total_ = 0;
+  uint64_t max_weight_ = 0;
+};
+
+// 紧凑字符集：全部字符的 UTF-8 字节连续存放在一张表里。所有字符字节数相同
+// （纯 ASCII、纯 3 字节汉字等）时按固定宽度槽位寻址，否则通过偏移数组寻址。
+class Charset {
+public:
+  Charset() = default;
+
+  // chars 为已去重的字符列表，顺序即索引顺序
+  explicit Charset(const std::vector<std::string> &chars);
+
+  // packed 为按 UTF-8 字节打包的字符（见 charSet.hpp 的 PackedChar：高位起
+  // 依次为各字节，最低字节为字节数），同样须已去重
+  explicit Charset(const std::vector<uint64_t> &packed);
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // 等宽字符集的每字符字节数；不等宽时为 0
+  size_t width() const { return width_; }
+  size_t max_width() const { return max_width_; }
+  size_t total_bytes() const { return bytes_.size(); }
+  const char *data() const { return bytes_.data(); }
+
+  std::string_view at(size_t index) const {
+    if (width_ != 0) {
+      return std::string_view(bytes_.data() + index * width_, width_);
+    }
+    return std::string_view(bytes_.data() + offsets_[index],
+                            offsets_[index + 1] - offsets_[index]);
+  }
+
+  // 把第 index 个字符写到 out，返回写入后的位置（仅用于不等宽字符集）
+  char *emit_variable(char *out, size_t index) const {
+    uint32_t begin = offsets_[index];
+    uint32_t end = offsets_[index + 1];
+    std::memcpy(out, bytes_.data() + begin, end - begin);
+    return out + (end - begin);
+  }
+
+  // 所有字符按顺序拼接的字符串（--show-charset）
+  const std::string &joined() const { return bytes_; }
+
+  // 为各字符设置整数权重（与索引一一对应），随即构建别名表；拷贝字符集时
+  // 共享同一张表。权重不合法时抛出 std::invalid_argument
+  void set_weights(const std::vector<uint64_t> &weights);
+
+  // 带权字符集的别名表；均匀字符集为空
+  const AliasTable *alias() const { return alias_.get(); }
+
+  // 每字符提供的熵（比特）：均匀字符集为 log2(n)；带权字符集取最小熵
+  // -log2(最大权重 / 总权重)，按最常出现的字符保守估计密钥强度
+  double bits_per_char() const;
+
+private:
+  std::string bytes_;             // 全部字符的字节
+  std::shared_ptr<const AliasTable> alias_;
+  std::vector<uint32_t> offsets_; // 第 i 个字符位于 [offsets_[i], offsets_[i+1])
+  size_t size_ = 0;
+  size_t width_ = 0;
+  size_t max_width_ = 0;
+};
+
+// UTF-8 校验内核：data 整段合法时返回 true
+struct Utf8ValidatorInfo {
+  bool (*validate)(const char *data, size_t size);
+  const char *name;
+};
+
+// 运行时选择的校验内核（AVX2 或标量）
+const Utf8ValidatorInfo &utf8_validator();
+
+struct CharsetFileInfo {
+  uint64_t bytes = 0; // 文件字节数
+  uint64_t chars = 0; // 非空白字符数（含重复）
+};
+
+// 加载字符集文件：映射文件并校验 UTF-8（非法编码、过长编码、代理区与截断
+// 序列均报错并给出字节偏移），去除空白后按码点位图去重，返回按码点升序的
+// 打包字符（见 Charset 的 packed 构造函数）。失败时抛出 std::runtime_error。
+std::vector<uint64_t> load_charset_file_packed(const std::string &path,
+                                               CharsetFileInfo *info = nullptr);
+
+// 加载带权字符集文件：每行“<字符> <权重>”，权重为非负整数（0 表示排除该
+// 字符），重复出现的字符权重相加，空行忽略；以 # 开头且不是“# <权重>”的行
+// 为注释。总权重不能超过 AliasTable::MAX_TOTAL_WEIGHT。失败时抛出
+// std::runtime_error。
+Charset load_weighted_charset(const std::string &path);
+
+// 按来源构建去重后的字符集：literal 为直接给出的字符，sources 中的 dn / en /
+// zh / sp 为内置字符集，其余视为文件路径。两者都为空时使用默认字符集（数字 +
+// 大小写英文字母）。无法读取的文件被跳过，原因追加到 warnings（可为空）；
+// 最终字符集为空时抛出 std::runtime_error。
+// stats 非空时记录各步骤耗时（--stats）
+struct CharsetBuildStats {
+  double load_seconds = 0;  // 读取字符集文件
+  double merge_seconds = 0; // 切分、排序、归并去重与构建字符表
+  uint64_t loaded_bytes = 0;
+  uint64_t loaded_chars = 0;  // 文件中的非空白字符数（含重复）
+  uint64_t loaded_unique = 0; // 文件中去重后的字符数
+};
+
+Charset build_charset(const std::string &literal,
+                      const std::vector<std::string> &sources,
+                      std::vector<std::string> *warnings = nullptr,
+                      CharsetBuildStats *stats = nullptr);
+
+// 读取一个字符集文件，返回按码点升序去重的打包字符；失败时抛出
+// std::runtime_error。默认为 load_charset_file_packed
+using CharsetFileLoader =
+    std::function<std::vector<uint64_t>(const std::string &path)>;
+
+// 同上，但字符集文件由 load_file 读取（如 --jobs 的缓存加载器），其余规则
+// 完全相同：load_file 抛出的文件被跳过，原因追加到 warnings
+Charset build_charset(const std::string &literal,
+                      const std::vector<std::string> &sources,
+                      const CharsetFileLoader &load_file,
+                      std::vector<std::string> *warnings = nullptr);
+
+// 64 位乘法：返回 a * b 的高 64 位，低 64 位写入 lo
+inline uint64_t mul_hi_lo(uint64_t a, uint64_t b, uint64_t *lo) {
+#if defined(__SIZEOF_INT128__)
+  unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+  *lo = static_cast<uint64_t>(product);
+  return static_cast<uint64_t>(product >> 64);
+#else
+  uint64_t a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+  uint64_t b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+  uint64_t p0 = a_lo * b_lo, p1 = a_lo * b_hi, p2 = a_hi * b_lo,
+           p3 = a_hi * b_hi;
+  uint64_t mid = (p0 >> 32) + (p1 & 0xFFFFFFFF) + (p2 & 0xFFFFFFFF);
+  *lo = (mid << 32) | (p0 & 0xFFFFFFFF);
+  return p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32);
+#endif
+}
+
+// 无偏索引采样器：Lemire 近乎无除法的乘法映射，并从每个 64 位随机字中批量
+// 提取 k 个索引。x * n 的高 64 位是第一个索引，低 64 位再乘 n 得到下一个，
+// 依此类推；这等价于把 x 映射到 [0, n^k) 再按 n 进制拆出 k 位，而最后剩下的
+// 低 64 位正是 x * n^k mod 2^64。它小于 2^64 mod n^k 时整批拒绝重抽，
+// 因此每个索引严格均匀且相互独立。拒绝阈值在构造时一次算好，抽取时没有除法。
+class IndexSampler {
+public:
+  static constexpr unsigned MAX_BATCH = 64;
+
+  explicit IndexSampler(uint64_t n);
+
+  ~IndexSampler() { secure_wipe(pending_, sizeof(pending_)); }
+
+  IndexSampler(const IndexSampler &) = delete;
+  IndexSampler &operator=(const IndexSampler &) = delete;
+
+  // 返回 [0, n) 中的一个均匀随机索引
+  template <typename Generator> uint32_t next(Generator &generator) {
+    static_assert(Generator::min() == 0 && Generator::max() == UINT64_MAX,
+                  "IndexSampler 需要输出完整 64 位的随机数引擎");
+    if (pos_ == count_) {
+      if (n_ <= 1) {
+        return 0;
+      }
+      refill(generator);
+    }
+    return pending_[pos_++];
+  }
+
+  // 丢弃尚未取走的索引（随机流切换时）
+  void discard() {
+    secure_wipe(pending_, sizeof(pending_));
+    pos_ = count_;
+  }
+
+  unsigned batch() const { return batch_; }
+  uint64_t words_drawn() const { return words_; }
+  uint64_t rejections() const { return rejections_; }
+
+private:
+  uint64_t n_;
+  unsigned batch_ = 1;
+  uint64_t threshold_ = 0;
+  uint32_t pending_[MAX_BATCH] = {};
+  unsigned pos_ = 0;
+  unsigned count_ = 0;
+  uint64_t words_ = 0;
+  uint64_t rejections_ = 0;
+
+  template <typename Generator> void refill(Generator &generator) {
+    for (;;) {
+      uint64_t lo = generator();
+      ++words_;
+      for (unsigned j = 0; j < batch_; ++j) {
+        pending_[j] = static_cast<uint32_t>(mul_hi_lo(lo, n_, &lo));
+      }
+      if (lo >= threshold_) {
+        break;
+      }
+      ++rejections_;
+    }
+    pos_ = 0;
+    count_ = batch_;
+  }
+};
+
+// ---------------------------------------------------------------------------
+// 小型 ASCII 字符集（单字节、不超过 128 个字符）的向量化内核
+// ---------------------------------------------------------------------------
+
+// 随机字节先与 mask（不小于 n 的 2 的幂减 1）相与，落在 [0, n) 的才接受，
+// 因此被接受的值严格均匀；再查 128 字节的字符表，最后按顺序压缩被接受的
+// 字节。所有实现对同一段随机字节产生完全相同的输出。
+struct AsciiTable {
+  alignas(16) unsigned char symbols[128] = {};
+  unsigned size = 0;
+  unsigned char mask = 0;
+};
+
+// 输出缓冲需要在 size 之外再预留的字节数（向量压缩整段写入）
+constexpr size_t ASCII_KERNEL_SLACK = 32;
+
+using AsciiKernel = size_t (*)(const unsigned char *random, size_t size,
+                               unsigned char *out, const AsciiTable &table);
+
+// ---------------------------------------------------------------------------
+// 2 的幂单字节字符集（hex、base32、base64 等）的位切片内核
+// ---------------------------------------------------------------------------
+
+// 随机字节视为小端位流，第 i 个字符取第 [i*b, (i+1)*b) 位（n = 2^b），
+// 不拒绝、不浪费熵。random 需可读 symbols * b / 8 + 8 字节；symbols 为 16
+// 的倍数时各实现输出完全相同。
+using Pow2Kernel = void (*)(const unsigned char *random, size_t symbols,
+                            unsigned bits, unsigned char *out,
+                            const AsciiTable &table);
+
+struct Pow2KernelInfo {
+  Pow2Kernel kernel;
+  const char *name;
+};
+
+const Pow2KernelInfo &pow2_kernel();
+
+// 可用的全部内核，排列方式同 chacha20_kernels()
+std::vector<Pow2KernelInfo> pow2_kernels();
+
+struct AsciiKernelInfo {
+  AsciiKernel kernel;
+  const char *name;
+};
+
+const AsciiKernelInfo &ascii_kernel();
+
+// 可用的全部内核，排列方式同 chacha20_kernels()
+std::vector<AsciiKernelInfo> ascii_kernels();
+
+// 批量获取随机字节：引擎提供 fill() 时直接调用，否则逐个 64 位拼接
+template <typename Generator, typename = void>
+struct has_fill : std::false_type {};
+template <typename Generator>
+struct has_fill<Generator,
+                std::void_t<decltype(std::declval<Generator &>().fill(
+                    std::declval<unsigned char *>(), size_t{}))>>
+    : std::true_type {};
+
+template <typename Generator>
+void fill_random(Generator &generator, unsigned char *buffer, size_t size) {
+  if constexpr (has_fill<Generator>::value) {
+    generator.fill(buffer, size);
+  } else {
+    while (size > 0) {
+      uint64_t value = generator();
+      size_t n = std::min(size, sizeof(value));
+      std::memcpy(buffer, &value, n);
+      buffer += n;
+      size -= n;
+    }
+  }
+}
+
+// 采样路径
+enum class SamplingPath {
+  lemire,     // 通用：IndexSampler 批量 Lemire 映射
+  alias,      // 带权字符集：别名表，每字符一次均匀列号加一次均匀硬币
+  ascii_simd, // 单字节、不超过 128 个字符：向量化内核
+  pow2,       // 字符数为 2 的幂：每个 64 位字直接切出 64 / log2(n) 个索引
+};
+
+// 按去重后的字符集选择最快的无偏路径。带权字符集只能走别名表；2 的幂字符集（hex、base32、base64
+// 等）优先走位切片：不拒绝、不做乘除，且每字符只消耗 log2(n) 位熵。
+SamplingPath select_sampling_path(const Charset &charset);
+
+// 字符集采样器：与一个引擎实例配套使用，路径由 select_sampling_path 决定。
+// 单个采样器不能跨线程共享。
+class CharsetSampler {
+public:
+  explicit CharsetSampler(const Charset &charset);
+  ~CharsetSampler();
+
+  CharsetSampler(const CharsetSampler &) = delete;
+  CharsetSampler &operator=(const CharsetSampler &) = delete;
+
+  // 把 length 个随机字符写到 out（至少可容纳 length * max_width() 字节），
+  // 返回写入后的位置。单字节字符集每个字符只是一次存储，等宽多字节字符集
+  // （如 zh）是一次定长拷贝。
+  template <typename Generator>
+  char *write(char *out, size_t length, Generator &generator) {
+    if (charset_.empty()) {
+      return out;
+    }
+    if (ascii_) {
+      return write_ascii(out, length, generator);
+    }
+    switch (path_) {
+    case SamplingPath::ascii_simd:
+    case SamplingPath::pow2:
+      return with_emitter([&](auto emit) {
+        // 常见的 hex / base32 / base64 位宽用编译期常量展开整字循环
+        switch (pow2_bits_) {
+        case 4:
+          return write_pow2<4>(out, length, generator, emit);
+        case 5:
+          return write_pow2<5>(out, length, generator, emit);
+        case 6:
+          return write_pow2<6>(out, length, generator, emit);
+        default:
+          return write_pow2<0>(out, length, generator, emit);
+        }
+      });
+    case SamplingPath::alias:
+      return with_emitter([&](auto emit) {
+        const AliasTable &table = *charset_.alias();
+        for (size_t i = 0; i < length; ++i) {
+          uint32_t column = sampler_.next(generator);
+          out = emit(out, table.pick(column, coin_.next(generator)));
+        }
+        return out;
+      });
+    case SamplingPath::lemire:
+      break;
+    }
+    return with_emitter([&](auto emit) {
+      for (size_t i = 0; i < length; ++i) {
+        out = emit(out, sampler_.next(generator));
+      }
+      return out;
+    });
+  }
+
+  const Charset &charset() const { return charset_; }
+  size_t max_width() const { return charset_.max_width(); }
+
+  // 丢弃已缓冲的随机数：之后输出的字符只取决于引擎此后的输出
+  void discard();
+
+  SamplingPath path() const { return path_; }
+
+  // 采样路径名称（--stats）
+  const char *path_name() const;
+
+  // 位切片路径每个字符消耗的随机位数
+  unsigned pow2_bits() const { return pow2_bits_; }
+
+  // 进程内所有已销毁采样器累计消耗的熵字节数与拒绝次数
+  static uint64_t total_entropy_bytes() {
+    return total_entropy_counter().load(std::memory_order_relaxed);
+  }
+  static uint64_t total_rejections() {
+    return total_rejections_counter().load(std::memory_order_relaxed);
+  }
+
+private:
+  static constexpr size_t RANDOM_BLOCK = 4096;
+
+  struct AsciiState {
+    AsciiTable table;
+    unsigned char random[RANDOM_BLOCK + 8]; // 位切片内核按 8 字节读取
+    unsigned char symbols[RANDOM_BLOCK + ASCII_KERNEL_SLACK];
+    size_t pos = 0;
+    size_t count = 0;
+    uint64_t random_bytes = 0; // 消耗的随机字节
+    uint64_t produced = 0;     // 被接受的字符数
+  };
+
+  const Charset &charset_;
+  IndexSampler sampler_;
+  IndexSampler coin_; // 别名表的硬币，[0, 总权重)；均匀字符集不使用
+  SamplingPath path_;
+  std::unique_ptr<AsciiState> ascii_;
+  unsigned pow2_bits_ = 1;
+  unsigned pow2_per_word_ = 0;
+  uint64_t pow2_buffer_ = 0; // 上一个字剩余未用的位
+  unsigned pow2_left_ = 0;   // pow2_buffer_ 中剩余的索引个数
+  uint64_t pow2_words_ = 0;
+  static constexpr size_t POW2_BATCH = 64; // 批量取随机字，摊薄引擎调用
+  uint64_t pow2_batch_[POW2_BATCH] = {};
+  size_t pow2_batch_pos_ = POW2_BATCH;
+
+  template <typename Generator> uint64_t next_pow2_word(Generator &generator) {
+    if (pow2_batch_pos_ == POW2_BATCH) {
+      fill_random(generator, reinterpret_cast<unsigned char *>(pow2_batch_),
+                  sizeof(pow2_batch_));
+      pow2_batch_pos_ = 0;
+      pow2_words_ += POW2_BATCH;
+    }
+    uint64_t word = pow2_batch_[pow2_batch_pos_];
+    pow2_batch_[pow2_batch_pos_++] = 0;
+    return word;
+  }
+
+  // 按字符宽度构造写字符的函数对象交给 f：单字节为一次存储，等宽多字节为
+  // 定长拷贝，不等宽通过偏移数组寻址
+  template <typename F> char *with_emitter(F f) const {
+    const char *table = charset_.data();
+    switch (charset_.width()) {
+    case 1:
+      return f([table](char *out, uint32_t index) {
+        *out = table[index];
+        return out + 1;
+      });
+    case 3:
+      return f([table](char *out, uint32_t index) {
+        std::memcpy(out, table + index * 3, 3);
+        return out + 3;
+      });
+    case 0:
+      return f([this](char *out, uint32_t index) {
+        return charset_.emit_variable(out, index);
+      });
+    default: {
+      const size_t width = charset_.width();
+      return f([table, width](char *out, uint32_t index) {
+        std::memcpy(out, table + index * width, width);
+        return out + width;
+      });
+    }
+    }
+  }
+
+  // 位切片：n = 2^b 时每个 64 位随机字的每 b 位都是一个均匀索引，
+  // 无需拒绝与乘除；整字循环一次产出 64 / b 个字符，零头留到下次使用
+  template <unsigned FixedBits, typename Generator, typename Emit>
+  char *write_pow2(char *out, size_t length, Generator &generator,
+                   Emit emit) {
+    const unsigned bits = FixedBits != 0 ? FixedBits : pow2_bits_;
+    const unsigned per_word = FixedBits != 0 ? 64 / FixedBits : pow2_per_word_;
+    const uint64_t mask = (uint64_t{1} << bits) - 1;
+    // 状态先读到局部变量：写字符的 char 存储可能与成员别名，避免每字符回写
+    uint64_t buffer = pow2_buffer_;
+    unsigned left = pow2_left_;
+    for (; length > 0 && left > 0; --length, --left) {
+      out = emit(out, static_cast<uint32_t>(buffer & mask));
+      buffer >>= bits;
+    }
+    for (; length >= per_word; length -= per_word) {
+      uint64_t word = next_pow2_word(generator);
+      for (unsigned j = 0; j < per_word; ++j) {
+        out = emit(out, static_cast<uint32_t>(word & mask));
+        word >>= bits;
+      }
+    }
+    if (length > 0) {
+      buffer = next_pow2_word(generator);
+      left = per_word;
+      for (; length > 0; --length, --left) {
+        out = emit(out, static_cast<uint32_t>(buffer & mask));
+        buffer >>= bits;
+      }
+    }
+    pow2_buffer_ = buffer;
+    pow2_left_ = left;
+    return out;
+  }
+
+  template <typename Generator> void refill_ascii(Generator &generator) {
+    AsciiState &state = *ascii_;
+    size_t random_bytes = RANDOM_BLOCK;
+    if (path_ == SamplingPath::pow2) {
+      // 每个字符恰好消耗 b 位
+      random_bytes = RANDOM_BLOCK / 8 * pow2_bits_;
+      fill_random(generator, state.random, random_bytes);
+      pow2_kernel().kernel(state.random, RANDOM_BLOCK, pow2_bits_,
+                           state.symbols, state.table);
+      state.count = RANDOM_BLOCK;
+    } else {
+      fill_random(generator, state.random, random_bytes);
+      state.count = ascii_kernel().kernel(state.random, RANDOM_BLOCK,
+                                          state.symbols, state.table);
+    }
+    secure_wipe(state.random, random_bytes);
+    state.pos = 0;
+    state.random_bytes += random_bytes;
+    state.produced += state.count;
+  }
+
+  template <typename Generator>
+  char *write_ascii(char *out, size_t length, Generator &generator) {
+    AsciiState &state = *ascii_;
+    while (length > 0) {
+      if (state.pos == state.count) {
+        refill_ascii(generator);
+      }
+      size_t n = std::min(length, state.count - state.pos);
+      std::memcpy(out, state.symbols + state.pos, n);
+      state.pos += n;
+      out += n;
+      length -= n;
+    }
+    return out;
+  }
+
+  static std::atomic<uint64_t> &total_entropy_counter();
+  static std::atomic<uint64_t> &total_rejections_counter();
+};
+
+// 调用者提供的输出缓冲区
+struct OutputSpan {
+  char *data = nullptr;
+  size_t size = 0;
+};
+
+// 一个长度为 length 的随机字符串最多占用的字节数
+inline size_t max_token_bytes(const Charset &charset, size_t length) {
+  return length * charset.max_width();
+}
+
+// count 个随机字符串以单字节分隔符隔开（末尾不加）时最多占用的字节数
+inline size_t max_batch_bytes(const Charset &charset, size_t length,
+                              size_t count) {
+  return count == 0 ? 0
+                    : count * max_token_bytes(charset, length) + (count - 1);
+}
+
+// 把 length 个随机字符写入调用者的缓冲区，返回实际写入的字节数（不含结尾
+// 的 '\0'）。不做堆分配；容量不足 max_token_bytes 时抛出 std::length_error。
+template <typename Generator>
+size_t generate_into(OutputSpan out, size_t length, CharsetSampler &sampler,
+                     Generator &generator) {
+  if (out.size < max_token_bytes(sampler.charset(), length)) {
+    throw std::length_error("输出缓冲区容量不足");
+  }
+  return static_cast<size_t>(sampler.write(out.data, length, generator) -
+                             out.data);
+}
+
+// 一次写入 count 个以 separator 分隔的随机字符串，返回实际写入的字节数；
+// 容量不足 max_batch_bytes 时抛出 std::length_error
+template <typename Generator>
+size_t generate_batch_into(OutputSpan out, size_t length, size_t count,
+                           char separator, CharsetSampler &sampler,
+                           Generator &generator) {
+  if (out.size < max_batch_bytes(sampler.charset(), length, count)) {
+    throw std::length_error("输出缓冲区容量不足");
+  }
+  char *end = out.data;
+  for (size_t i = 0; i < count; ++i) {
+    if (i > 0) {
+      *end++ = separator;
+    }
+    end = sampler.write(end, length, generator);
+  }
+  return static_cast<size_t>(end - out.data);
+}
+
+// 在 str 末尾追加 length 个随机字符
+template <typename Generator>
+void append_random_string(std::string &str, size_t length,
+                          CharsetSampler &sampler, Generator &generator) {
+  size_t old_size = str.size();
+  str.resize(old_size + length * sampler.max_width());
+  char *end = sampler.write(&str[old_size], length, generator);
+  str.resize(static_cast<size_t>(end - str.data()));
+}
+
+// 函数：生成指定长度的随机字符串；generator 可以是任何满足
+// UniformRandomBitGenerator 的引擎（SystemRandomGenerator、ChaCha20Generator）
+template <typename Generator>
+std::string generate_random_string(size_t length, const Charset &charset,
+                                   Generator &generator) {
+  std::string random_string;
+  CharsetSampler sampler(charset);
+  append_random_string(random_string, length, sampler, generator);
+  return random_string;
+}
+
+// 令牌来源：下面的输出函数对“每个令牌怎么写”只要求
+//   size_t max_bytes() const;   // 单个令牌最多占用的字节数
+//   bool fixed_size() const;    // 每个令牌是否恰好 max_bytes() 字节
+//   writer()                    // 每个线程一个，write(out, generator) 写一个
+//                               // 令牌并返回写入后的位置；discard() 丢弃
+//                               // 缓冲的随机数（见 begin_token）
+//   std::string alphabet() const;  // 令牌中可能出现的全部字节（可重复），
+//                                  // 用于判断输出格式是否需要转义
+// CharsetTokens（单一字符集、固定长度）与 TokenPattern（按模板逐段生成）
+// 都满足这一约定。
+
+// 单一字符集、固定长度的令牌
+class CharsetTokens {
+public:
+  CharsetTokens(const Charset &charset, size_t length)
+      : charset_(charset), length_(length) {}
+
+  size_t max_bytes() const { return length_ * charset_.max_width(); }
+  bool fixed_size() const { return charset_.width() != 0 || length_ == 0; }
+  std::string alphabet() const { return charset_.joined(); }
+
+  class Writer {
+  public:
+    Writer(const Charset &charset, size_t length)
+        : sampler_(charset), length_(length) {}
+
+    template <typename Generator>
+    char *write(char *out, Generator &generator) {
+      return sampler_.write(out, length_, generator);
+    }
+
+    void discard() { sampler_.discard(); }
+
+  private:
+    CharsetSampler sampler_;
+    size_t length_;
+  };
+
+  Writer writer() const { return Writer(charset_, length_); }
+
+private:
+  const Charset &charset_;
+  size_t length_;
+};
+
+// 模板令牌（--pattern）：把模板编译成字面量段与采样段交替的扁平执行计划，
+// 每个采样段持有预先构建的字符集，生成时逐段写出。模板语法：
+//   [A-Z0-9_]  字符集合，支持按码点的区间（可含中文，如 [一-龥]）
+//   {dn}       内置字符集，可用 + 组合（如 {dn+en}）；{*} 为 -s / -c /
+//              --weights 指定的字符集
+//   {4}        紧跟在字符类或字面字符之后，表示重复次数
+//   \x         转义，取字面字符 x
+//   其他字符    原样输出
+// 例：{en}{4}-{dn}{4}-[a-z]{4}。每个采样段与用同一字符集、同样长度调用普通
+// 生成器的分布完全相同（同一个 CharsetSampler）。
+class TokenPattern {
+public:
+  static constexpr size_t MAX_REPEAT = 1000000;
+
+  // 编译模板；语法错误时抛出 std::invalid_argument
+  static TokenPattern compile(std::string_view text,
+                              const Charset &default_charset);
+
+  size_t max_bytes() const { return max_bytes_; }
+  bool fixed_size() const { return fixed_size_; }
+  size_t segment_count() const { return segments_.size(); }
+
+  std::string alphabet() const {
+    std::string bytes;
+    for (const Segment &segment : segments_) {
+      bytes += segment.charset ? segment.charset->joined() : segment.literal;
+    }
+    return bytes;
+  }
+
+  // 每个令牌中随机字符的个数与熵（比特；带权字符集按最小熵）
+  size_t sampled_chars() const { return sampled_chars_; }
+  double bits() const { return bits_; }
+
+  // 可能的令牌种数的 log2（--unique 检查数量是否超出）
+  double space_bits() const { return space_bits_; }
+
+  // 执行计划的可读描述（--show-charset）
+  std::string describe() const;
+
+  class Writer {
+  public:
+    explicit Writer(const TokenPattern &pattern) : pattern_(pattern) {
+      for (const Segment &segment : pattern.segments_) {
+        samplers_.push_back(segment.charset
+                                ? std::make_unique<CharsetSampler>(*segment.charset)
+                                : nullptr);
+      }
+    }
+
+    template <typename Generator>
+    char *write(char *out, Generator &generator) {
+      const std::vector<Segment> &segments = pattern_.segments_;
+      for (size_t i = 0; i < segments.size(); ++i) {
+        const Segment &segment = segments[i];
+        if (segment.charset) {
+          out = samplers_[i]->write(out, segment.count, generator);
+        } else {
+          std::memcpy(out, segment.literal.data(), segment.literal.size());
+          out += segment.literal.size();
+        }
+      }
+      return out;
+    }
+
+    void discard() {
+      for (auto &sampler : samplers_) {
+        if (sampler) {
+          sampler->discard();
+        }
+      }
+    }
+
+  private:
+    const TokenPattern &pattern_;
+    std::vector<std::unique_ptr<CharsetSampler>> samplers_; // 字面量段为空
+  };
+
+  Writer writer() const { return Writer(*this); }
+
+private:
+  struct Segment {
+    std::string literal;                    // 字面量段
+    std::shared_ptr<const Charset> charset; // 采样段
+    std::string name;                       // 字符类的写法（合并相邻段、描述）
+    size_t count = 0;                       // 采样段的字符数
+  };
+  std::vector<Segment> segments_;
+  size_t max_bytes_ = 0;
+  bool fixed_size_ = true;
+  size_t sampled_chars_ = 0;
+  double bits_ = 0;
+  double space_bits_ = 0;
+};
+
+// 按 --pattern 的写法构建一个字符类：dn、{dn+en} 等内置字符集组合，[A-Z0-9_]
+// 字符集合，或 {*}（即 default_charset）。写法错误时抛出
+// std::invalid_argument
+Charset build_char_class(std::string_view spec, const Charset &default_charset);
+
+// --exclude-ambiguous 去掉的易混淆字符
+constexpr std::string_view AMBIGUOUS_CHARS = "0Oo1lI|`'\"";
+
+// 去掉 chars 中出现的字符，其余字符保持原顺序；结果为空时抛出
+// std::runtime_error。不支持带权字符集
+Charset exclude_chars(const Charset &charset, std::string_view chars);
+
+// 口令策略（--require / --no-repeat）：每个令牌先从各必需字符类中抽出规定
+// 个数的字符，其余位置从整个字符集抽取，最后用同一个引擎做无偏的
+// Fisher–Yates 洗牌。构造即满足策略，不需要“生成后检查、不合格重来”。
+// 必需字符类与字符集求交，按交集从小到大抽取；--no-repeat 时同一令牌内
+// 不出现重复字符（已用过的字符当场重抽）。
+class TokenPolicy {
+public:
+  struct Requirement {
+    std::string name;              // 写法，如 dn、[A-Z]
+    std::vector<uint32_t> members; // 在字符集中的索引
+    size_t count = 0;
+  };
+
+  // spec 形如 "dn:1,sp:2,[A-Z]:1"，可为空（仅 --no-repeat）。写法错误或
+  // 字符类与字符集没有共同字符时抛出 std::invalid_argument
+  static TokenPolicy compile(std::string_view spec, const Charset &charset,
+                             bool no_repeat);
+
+  const Charset &charset() const { return *charset_; }
+  const std::vector<Requirement> &requirements() const { return requirements_; }
+  bool no_repeat() const { return no_repeat_; }
+  size_t required() const { return required_; }
+
+  // 长度为 length 时无法满足策略则抛出 std::invalid_argument
+  void check(size_t length) const;
+
+  // 长度为 length 的令牌熵的下限（比特）：各次抽取的可选字符数取对数求和
+  // （--no-repeat 时按最坏情况扣除已用字符），不计洗牌带来的熵。令牌由
+  // 抽取结果与洗牌排列共同决定，而排列已知时可由令牌还原抽取结果，所以
+  // 令牌的熵不低于抽取的熵
+  double bits(size_t length) const;
+
+  // 熵下限达到 key_bits 的最短长度；无法达到时抛出 std::invalid_argument
+  size_t length_for_bits(double key_bits) const;
+
+  // 可读描述（--show-charset）
+  std::string describe() const;
+
+private:
+  const Charset *charset_ = nullptr;
+  std::vector<Requirement> requirements_;
+  // overlap_[i]：排在 i 之前的字符类最多能占用 i 中的多少个字符
+  std::vector<size_t> overlap_;
+  bool no_repeat_ = false;
+  size_t required_ = 0;
+
+  // 各次抽取的最少可选字符数之积的 log2；某次可能无字符可选时返回 -1
+  double draw_bits(size_t length) const;
+};
+
+// 按策略生成、长度为 length 的令牌
+class PolicyTokens {
+public:
+  PolicyTokens(const TokenPolicy &policy, size_t length)
+      : policy_(policy), length_(length) {}
+
+  size_t max_bytes() const { return length_ * policy_.charset().max_width(); }
+  bool fixed_size() const { return policy_.charset().width() != 0 || length_ == 0; }
+  std::string alphabet() const { return policy_.charset().joined(); }
+
+  class Writer {
+  public:
+    Writer(const TokenPolicy &policy, size_t length)
+        : policy_(policy), fill_(policy.charset().size()), picks_(length) {
+      for (const auto &requirement : policy.requirements()) {
+        samplers_.push_back(
+            std::make_unique<IndexSampler>(requirement.members.size()));
+      }
+      if (policy.no_repeat()) {
+        used_.assign(policy.charset().size(), 0);
+      }
+    }
+
+    ~Writer() {
+      uint64_t words = fill_.words_drawn() + shuffle_words_;
+      uint64_t rejections = fill_.rejections() + rejections_;
+      for (const auto &sampler : samplers_) {
+        words += sampler->words_drawn();
+        rejections += sampler->rejections();
+      }
+      record_usage(words * 8, rejections);
+      secure_wipe(picks_.data(), picks_.size() * sizeof(uint32_t));
+      secure_wipe(swaps_, sizeof(swaps_));
+    }
+
+    template <typename Generator>
+    char *write(char *out, Generator &generator) {
+      const auto &requirements = policy_.requirements();
+      size_t pos = 0;
+      for (size_t i = 0; i < requirements.size(); ++i) {
+        const std::vector<uint32_t> &members = requirements[i].members;
+        for (size_t k = 0; k < requirements[i].count; ++k) {
+          uint32_t index;
+          do {
+            index = members[samplers_[i]->next(generator)];
+          } while (!take(index));
+          picks_[pos++] = index;
+        }
+      }
+      while (pos < picks_.size()) {
+        uint32_t index;
+        do {
+          index = fill_.next(generator);
+        } while (!take(index));
+        picks_[pos++] = index;
+      }
+
+      // Fisher–Yates：位置 i - 1 与 [0, i) 中均匀选出的位置交换。相邻若干
+      // 步共用一个 64 位随机字，按 IndexSampler 的做法依次乘以各步的上界
+      // 拆出下标；上界之积 product 不超过 2^48，最后剩下的低 64 位小于
+      // 2^64 mod product 时整组重抽，各下标仍严格均匀且相互独立
+      size_t i = picks_.size();
+      while (i > 1) {
+        uint64_t product = i;
+        size_t last = i - 1; // 本组处理上界 i, i - 1, ..., last + 1
+        while (last > 1 && product <= (uint64_t{1} << 48) / last) {
+          product *= last--;
+        }
+        uint64_t lo;
+        for (;;) {
+          lo = generator();
+          ++shuffle_words_;
+          for (size_t bound = i; bound > last; --bound) {
+            swaps_[i - bound] = mul_hi_lo(lo, bound, &lo);
+          }
+          if (lo >= product || lo >= (0 - product) % product) {
+            break;
+          }
+          ++rejections_;
+        }
+        for (size_t bound = i; bound > last; --bound) {
+          std::swap(picks_[bound - 1], picks_[swaps_[i - bound]]);
+        }
+        i = last;
+      }
+
+      const Charset &charset = policy_.charset();
+      const size_t width = charset.width();
+      for (uint32_t index : picks_) {
+        if (width != 0) {
+          std::memcpy(out, charset.data() + size_t{index} * width, width);
+          out += width;
+        } else {
+          out = charset.emit_variable(out, index);
+        }
+        if (!used_.empty()) {
+          used_[index] = 0;
+        }
+      }
+      return out;
+    }
+
+    void discard() {
+      fill_.discard();
+      for (auto &sampler : samplers_) {
+        sampler->discard();
+      }
+    }
+
+  private:
+    const TokenPolicy &policy_;
+    IndexSampler fill_;
+    std::vector<std::unique_ptr<IndexSampler>> samplers_;
+    std::vector<uint32_t> picks_;
+    std::vector<unsigned char> used_; // --no-repeat：本令牌已抽到的字符
+    uint64_t swaps_[48] = {};         // 一组洗牌的下标（上界都不小于 2）
+    uint64_t shuffle_words_ = 0;      // 洗牌取用的 64 位随机字数
+    uint64_t rejections_ = 0;         // 洗牌整组重抽与 --no-repeat 重抽次数
+
+    bool take(uint32_t index) {
+      if (used_.empty()) {
+        return true;
+      }
+      if (used_[index]) {
+        ++rejections_;
+        return false;
+      }
+      used_[index] = 1;
+      return true;
+    }
+  };
+
+  Writer writer() const { return Writer(policy_, length_); }
+
+  // 进程内所有已销毁 writer 累计消耗的熵字节数（各采样器与洗牌取用的随机
+  // 字）与拒绝次数，与 CharsetSampler 的计数分开
+  static uint64_t total_entropy_bytes();
+  static uint64_t total_rejections();
+
+private:
+  const TokenPolicy &policy_;
+  size_t length_;
+
+  static void record_usage(uint64_t entropy_bytes, uint64_t rejections);
+};
+
+// 令牌之间与末尾的分隔方式：同一行的令牌之间写 word，每 per_line 个令牌
+// 以及全部输出的末尾写 line；separated 为 false 时令牌直接相连（自带长度
+// 前缀的二进制格式）。默认值即纯文本布局
+struct OutputLayout {
+  char word = ' ';
+  char line = '\n';
+  bool separated = true;
+};
+
+// 第 index 个令牌之后的分隔符（count 个令牌中的最后一个之后为 line）
+inline char separator_after(const OutputLayout &layout, uint64_t index,
+                            uint64_t count, uint64_t per_line) {
+  return (index + 1 == count || (index + 1) % per_line == 0) ? layout.line
+                                                              : layout.word;
+}
+
+// 按 per_line 布局向 out 输出 count 个由 source 生成的令牌
+template <typename Generator, typename Source>
+void output_random_strings(Generator &generator, const Source &source,
+                           uint64_t count, uint64_t per_line,
+                           OutputWriter &out,
+                           const OutputLayout &layout = OutputLayout()) {
+  const size_t max_string_bytes = source.max_bytes();
+  const uint64_t stream_mask = stream_tokens(max_string_bytes) - 1;
+  auto writer = source.writer();
+  for (uint64_t i = 0; i < count; ++i) {
+    // 添加分隔符
+    if (i > 0 && layout.separated) {
+      out.append(i % per_line == 0 ? layout.line : layout.word);
+    }
+    begin_token(generator, writer, i, stream_mask);
+    char *dest = out.reserve(max_string_bytes);
+    out.commit(writer.write(dest, generator));
+  }
+  if (layout.separated) {
+    out.append(layout.line);
+  }
+  out.flush();
+}
+
+// 按 per_line 布局向 out 输出 count 个随机字符串
+template <typename Generator>
+void output_random_strings(Generator &generator, const Charset &charset,
+                           size_t length, uint64_t count, uint64_t per_line,
+                           OutputWriter &out) {
+  output_random_strings(generator, CharsetTokens(charset, length), count,
+                        per_line, out);
+}
+
+// 多线程生成：把 count 个字符串按块切分，每个 worker 持有由 make_generator
+// 创建的独立引擎和独立缓冲，整块生成后放入槽位；调用线程按块序号依次写出，
+// 保证 -n 布局与单线程完全一致。槽位数固定为线程数的 2 倍，内存占用恒定。
+template <typename MakeGenerator, typename Source>
+void output_random_strings_parallel(MakeGenerator make_generator,
+                                    const Source &source, uint64_t count,
+                                    uint64_t per_line, unsigned threads,
+                                    OutputWriter &out,
+                                    const OutputLayout &layout = OutputLayout()) {
+  // 每块约 256 KB 输出，摊薄同步开销
+  const size_t TARGET_CHUNK_BYTES = 256 * 1024;
+  const size_t max_string_bytes = source.max_bytes();
+  using Generator = decltype(make_generator());
+  const uint64_t chunk_tokens = align_chunk_tokens<Generator>(
+      std::max<uint64_t>(1, TARGET_CHUNK_BYTES / (max_string_bytes + 1)),
+      max_string_bytes);
+  const uint64_t stream_mask = stream_tokens(max_string_bytes) - 1;
+  const uint64_t chunks = (count + chunk_tokens - 1) / chunk_tokens;
+  const uint64_t slots = static_cast<uint64_t>(threads) * 2;
+
+  struct Slot {
+    std::string data;
+    uint64_t chunk = UINT64_MAX; // 槽位中已就绪的块号
+  };
+  std::vector<Slot> slot(slots);
+  std::mutex mutex;
+  std::condition_variable cv;
+  uint64_t next_chunk = 0; // 下一个待认领的块
+  uint64_t written = 0;    // 已写出的块数
+  bool stop = false;
+  std::exception_ptr error;
+
+  auto worker = [&] {
+    try {
+      auto generator = make_generator();
+      auto writer = source.writer();
+      std::string buffer;
+      for (;;) {
+        uint64_t chunk;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          // 只有对应槽位已被写出后才能认领新块
+          cv.wait(lock, [&] {
+            return stop || next_chunk >= chunks ||
+                   next_chunk < written + slots;
+          });
+          if (stop || next_chunk >= chunks) {
+            return;
+          }
+          chunk = next_chunk++;
+        }
+
+        buffer.clear();
+        uint64_t first = chunk * chunk_tokens;
+        uint64_t last = std::min(count, first + chunk_tokens);
+        for (uint64_t i = first; i < last; ++i) {
+          if (i > 0 && layout.separated) {
+            buffer += (i % per_line == 0 ? layout.line : layout.word);
+          }
+          begin_token(generator, writer, i, stream_mask);
+          size_t old_size = buffer.size();
+          buffer.resize(old_size + max_string_bytes);
+          char *end = writer.write(&buffer[old_size], generator);
+          buffer.resize(static_cast<size_t>(end - buffer.data()));
+        }
+
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          Slot &s = slot[chunk % slots];
+          s.data.swap(buffer); // 复用上一轮已写出块的缓冲
+          s.chunk = chunk;
+        }
+        cv.notify_all();
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+      stop = true;
+      cv.notify_all();
+    }
+  };
+
+  std::vector<std::thread> pool;
+  auto shutdown = [&] {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    cv.notify_all();
+    for (auto &t : pool) {
+      t.join();
+    }
+  };
+
+  for (unsigned t = 0; t < threads; ++t) {
+    pool.emplace_back(worker);
+  }
+  try {
+    for (uint64_t chunk = 0; chunk < chunks; ++chunk) {
+      Slot &s = slot[chunk % slots];
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return stop || s.chunk == chunk; });
+        if (s.chunk != chunk) {
+          break; // worker 出错
+        }
+      }
+      // 该槽位在 written 递增前不会被 worker 改写，可以在锁外写出
+      out.append(s.data);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        s.chunk = UINT64_MAX;
+        ++written;
+      }
+      cv.notify_all();
+    }
+    if (written == chunks) {
+      if (layout.separated) {
+        out.append(layout.line);
+      }
+      out.flush();
+    }
+  } catch (...) {
+    shutdown();
+    throw;
+  }
+  shutdown();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+template <typename MakeGenerator>
+void output_random_strings_parallel(MakeGenerator make_generator,
+                                    const Charset &charset, size_t length,
+                                    uint64_t count, uint64_t per_line,
+                                    unsigned threads, OutputWriter &out) {
+  output_random_strings_parallel(make_generator, CharsetTokens(charset, length),
+                                 count, per_line, threads, out);
+}
+
+// 根据线程数选择单线程或多线程生成
+template <typename MakeGenerator, typename Source>
+void run_generation(MakeGenerator make_generator, const Source &source,
+                    uint64_t count, uint64_t per_line, unsigned threads,
+                    OutputWriter &out,
+                    const OutputLayout &layout = OutputLayout()) {
+  if (threads <= 1) {
+    auto generator = make_generator();
+    output_random_strings(generator, source, count, per_line, out, layout);
+  } else {
+    output_random_strings_parallel(make_generator, source, count, per_line,
+                                   threads, out, layout);
+  }
+}
+
+template <typename MakeGenerator>
+void run_generation(MakeGenerator make_generator, const Charset &charset,
+                    size_t length,
+                    uint64_t count, uint64_t per_line, unsigned threads,
+                    OutputWriter &out) {
+  run_generation(make_generator, CharsetTokens(charset, length), count,
+                 per_line, threads, out);
+}
+
+// ---------------------------------------------------------------------------
+// 流水线输出（--pipeline）
+// ---------------------------------------------------------------------------
+
+// 等待与唤醒：条件已满足时不加锁；只有确实要睡眠的一方才进入互斥量与条件
+// 变量，通知方没有等待者时只付出一次原子读
+class Doorbell {
+public:
+  // 等到 ready() 为真；曾经睡眠时返回 true
+  template <typename Ready> bool wait(Ready ready) {
+    for (int i = 0; i < SPINS; ++i) {
+      if (ready()) {
+        return false;
+      }
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    waiters_.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    cv_.wait(lock, ready);
+    waiters_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // 在发布（release 存储）之后调用
+  void notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      cv_.notify_all();
+    }
+  }
+
+private:
+  static constexpr int SPINS = 64;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::atomic<int> waiters_{0};
+};
+
+struct PipelineOptions {
+  static constexpr size_t DEFAULT_BUFFER_SIZE = 1024 * 1024; // 1 MB
+
+  size_t buffer_size = DEFAULT_BUFFER_SIZE; // 每个缓冲区的字节数
+  // 环的槽位（缓冲区）数，至少 2；0 表示 max(4, 2 * 线程数)
+  unsigned depth = 0;
+};
+
+struct PipelineStats {
+  size_t buffer_bytes = 0; // 实际的缓冲区大小（按令牌数取整后）
+  unsigned depth = 0;
+  uint64_t buffers = 0;         // 写出的缓冲区个数
+  uint64_t producer_stalls = 0; // 生成线程因环满（输出端慢）睡眠的次数
+  uint64_t writer_stalls = 0;   // 写出线程因环空（生成慢）睡眠的次数
+  double producer_stall_seconds = 0; // 各生成线程累计
+  double writer_stall_seconds = 0;
+};
+
+// 生成与写出重叠的流水线：threads 个生成线程从预先分配的缓冲池中取缓冲区
+// 填满整块令牌，经无锁有序环交给调用线程（写出线程）阻塞写出，写完的
+// 缓冲区原地归还复用，稳态下没有内存分配。
+//
+// 第 c 块使用槽位 c % depth。槽位的 seq 为 c 时可供第 c 块写入，为 c + 1
+// 时第 c 块已就绪；写出线程写完后把 seq 设为 c + depth，交还给第 c + depth
+// 块。缓冲区只通过 seq 的 acquire / release 交接，只有一方需要等待时才经
+// Doorbell 睡眠。输出与 run_generation 逐字节相同。
+template <typename MakeGenerator, typename Source>
+PipelineStats output_random_strings_pipelined(
+    MakeGenerator make_generator, const Source &source, uint64_t count,
+    uint64_t per_line, unsigned threads, OutputWriter &out,
+    const PipelineOptions &options,
+    const OutputLayout &layout = OutputLayout()) {
+  const size_t max_string_bytes = source.max_bytes();
+  using Generator = decltype(make_generator());
+  // 每块按令牌最大长度加分隔符计，保证放得下
+  const uint64_t chunk_tokens = align_chunk_tokens<Generator>(
+      std::max<uint64_t>(1, options.buffer_size / (max_string_bytes + 1)),
+      max_string_bytes);
+  const uint64_t chunks = (count + chunk_tokens - 1) / chunk_tokens;
+  const uint64_t stream_mask = stream_tokens(max_string_bytes) - 1;
+  threads = std::max(1u, threads);
+
+  PipelineStats stats;
+  stats.buffer_bytes = static_cast<size_t>(chunk_tokens * (max_string_bytes + 1));
+  // 至少两个槽位：只有一个槽位时“第 c 块就绪”与“可供第 c + 1 块写入”
+  // 是同一个 seq
+  stats.depth = options.depth > 0 ? std::max(2u, options.depth)
+                                  : std::max(4u, threads * 2);
+
+  struct Slot {
+    std::atomic<uint64_t> seq{0};
+    std::unique_ptr<char[]> data;
+    size_t size = 0;
+  };
+  const uint64_t depth = stats.depth;
+  std::unique_ptr<Slot[]> slots(new Slot[depth]);
+  for (uint64_t i = 0; i < depth; ++i) {
+    slots[i].seq.store(i, std::memory_order_relaxed);
+    slots[i].data = std::make_unique<char[]>(stats.buffer_bytes);
+  }
+
+  std::atomic<uint64_t> next_chunk{0};
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> producer_stalls{0};
+  std::atomic<uint64_t> producer_stall_ns{0};
+  Doorbell producers_bell;
+  Doorbell writer_bell;
+  std::mutex error_mutex;
+  std::exception_ptr error;
+
+  // 睡眠时才读时钟
+  auto timed_wait = [](Doorbell &bell, auto ready, uint64_t &stalls,
+                       uint64_t &stall_ns) {
+    auto start = std::chrono::steady_clock::now();
+    if (bell.wait(ready)) {
+      ++stalls;
+      stall_ns += static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start)
+              .count());
+    }
+  };
+
+  auto worker = [&] {
+    uint64_t stalls = 0;
+    uint64_t stall_ns = 0;
+    try {
+      auto generator = make_generator();
+      auto writer = source.writer();
+      for (;;) {
+        uint64_t chunk = next_chunk.fetch_add(1, std::memory_order_relaxed);
+        if (chunk >= chunks || stop.load(std::memory_order_relaxed)) {
+          break;
+        }
+        Slot &slot = slots[chunk % depth];
+        timed_wait(
+            producers_bell,
+            [&] {
+              return slot.seq.load(std::memory_order_acquire) == chunk ||
+                     stop.load(std::memory_order_relaxed);
+            },
+            stalls, stall_ns);
+        if (stop.load(std::memory_order_relaxed)) {
+          break;
+        }
+        char *dest = slot.data.get();
+        uint64_t first = chunk * chunk_tokens;
+        uint64_t last = std::min(count, first + chunk_tokens);
+        for (uint64_t i = first; i < last; ++i) {
+          if (i > 0 && layout.separated) {
+            *dest++ = i % per_line == 0 ? layout.line : layout.word;
+          }
+          begin_token(generator, writer, i, stream_mask);
+          dest = writer.write(dest, generator);
+        }
+        slot.size = static_cast<size_t>(dest - slot.data.get());
+        slot.seq.store(chunk + 1, std::memory_order_release);
+        writer_bell.notify();
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+      stop.store(true);
+      producers_bell.notify();
+      writer_bell.notify();
+    }
+    producer_stalls.fetch_add(stalls, std::memory_order_relaxed);
+    producer_stall_ns.fetch_add(stall_ns, std::memory_order_relaxed);
+  };
+
+  std::vector<std::thread> pool;
+  auto shutdown = [&] {
+    stop.store(true);
+    producers_bell.notify();
+    writer_bell.notify();
+    for (auto &t : pool) {
+      t.join();
+    }
+    for (uint64_t i = 0; i < depth; ++i) {
+      secure_wipe(slots[i].data.get(), stats.buffer_bytes);
+    }
+    stats.producer_stalls = producer_stalls.load();
+    stats.producer_stall_seconds = producer_stall_ns.load() / 1e9;
+  };
+
+  for (unsigned t = 0; t < threads; ++t) {
+    pool.emplace_back(worker);
+  }
+  uint64_t writer_stall_ns = 0;
+  try {
+    for (uint64_t chunk = 0; chunk < chunks; ++chunk) {
+      Slot &slot = slots[chunk % depth];
+      timed_wait(
+          writer_bell,
+          [&] {
+            return slot.seq.load(std::memory_order_acquire) == chunk + 1 ||
+                   stop.load(std::memory_order_relaxed);
+          },
+          stats.writer_stalls, writer_stall_ns);
+      if (slot.seq.load(std::memory_order_acquire) != chunk + 1) {
+        break; // 生成线程出错
+      }
+      out.write_direct(slot.data.get(), slot.size);
+      ++stats.buffers;
+      slot.seq.store(chunk + depth, std::memory_order_release);
+      producers_bell.notify();
+    }
+    if (stats.buffers == chunks) {
+      if (layout.separated) {
+        out.append(layout.line);
+      }
+      out.flush();
+    }
+  } catch (...) {
+    shutdown();
+    throw;
+  }
+  shutdown();
+  stats.writer_stall_seconds = writer_stall_ns / 1e9;
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return stats;
+}
+
+// 打开（创建或截断）输出文件，返回文件描述符；失败时抛出 std::runtime_error
+int open_output_file(const std::string &path);
+void close_output_file(int fd);
+
+// 写文件时 OutputWriter 的缓冲区大小：每次 write 都是整块，减少系统调用
+constexpr size_t FILE_BUFFER_SIZE = 8 * 1024 * 1024; // 8 MB
+
+// 定长令牌的输出大小可以事先算出：每个令牌 max_bytes() 字节，后跟一个分隔符
+// （layout.separated 时）。令牌不定长、count 为 0 或溢出时返回 0
+template <typename Source>
+uint64_t mapped_output_bytes(const Source &source, uint64_t count,
+                             const OutputLayout &layout = OutputLayout()) {
+  uint64_t stride =
+      static_cast<uint64_t>(source.max_bytes()) + (layout.separated ? 1 : 0);
+  if (stride == 0 || !source.fixed_size() || count == 0 ||
+      count > UINT64_MAX / stride) {
+    return 0;
+  }
+  return count * stride;
+}
+
+inline uint64_t mapped_output_bytes(const Charset &charset, size_t length,
+                                    uint64_t count) {
+  return mapped_output_bytes(CharsetTokens(charset, length), count);
+}
+
+// 预分配并映射到内存的输出文件：先用 fallocate 分配磁盘块（磁盘空间不足会在
+// 生成之前报错），再以 MAP_SHARED 映射，生成结果直接写入页缓存，省去用户态
+// 缓冲与 write 的拷贝。失败时抛出 std::runtime_error。
+class MappedOutput {
+public:
+  // fd 能否映射：须为普通文件，设备（/dev/null）、管道与套接字无法预分配或
+  // 映射；Windows 上一律不支持。返回 false 时调用者应改用 OutputWriter
+  static bool supported(int fd);
+
+  MappedOutput(int fd, uint64_t size);
+  ~MappedOutput();
+  MappedOutput(const MappedOutput &) = delete;
+  MappedOutput &operator=(const MappedOutput &) = delete;
+
+  char *data() const { return data_; }
+  uint64_t size() const { return size_; }
+
+private:
+  char *data_ = nullptr;
+  uint64_t size_ = 0;
+};
+
+// 定长令牌的原地生成：第 i 个令牌固定位于 i * (max_bytes() + 分隔符)，各线程
+// 认领互不重叠的区间直接写入 out（至少 mapped_output_bytes 字节），无需按序
+// 汇总，-n 布局与 run_generation 完全一致
+template <typename MakeGenerator, typename Source>
+void output_random_strings_mapped(MakeGenerator make_generator,
+                                  const Source &source, uint64_t count,
+                                  uint64_t per_line, unsigned threads,
+                                  char *out,
+                                  const OutputLayout &layout = OutputLayout()) {
+  const uint64_t stride =
+      static_cast<uint64_t>(source.max_bytes()) + (layout.separated ? 1 : 0);
+  // 每个区间约 4 MB，线程间按需认领以均衡负载
+  const uint64_t chunk_tokens = align_chunk_tokens<decltype(make_generator())>(
+      std::max<uint64_t>(1, (4 * 1024 * 1024) / stride), source.max_bytes());
+  const uint64_t stream_mask = stream_tokens(source.max_bytes()) - 1;
+  const uint64_t chunks = (count + chunk_tokens - 1) / chunk_tokens;
+  std::atomic<uint64_t> next_chunk{0};
+  std::atomic<bool> stop{false};
+  std::mutex mutex;
+  std::exception_ptr error;
+
+  auto worker = [&] {
+    try {
+      auto generator = make_generator();
+      auto writer = source.writer();
+      for (;;) {
+        uint64_t chunk = next_chunk.fetch_add(1, std::memory_order_relaxed);
+        if (chunk >= chunks || stop.load(std::memory_order_relaxed)) {
+          return;
+        }
+        uint64_t first = chunk * chunk_tokens;
+        uint64_t last = std::min(count, first + chunk_tokens);
+        char *dest = out + first * stride;
+        for (uint64_t i = first; i < last; ++i) {
+          begin_token(generator, writer, i, stream_mask);
+          dest = writer.write(dest, generator);
+          if (layout.separated) {
+            *dest++ = separator_after(layout, i, count, per_line);
+          }
+        }
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+      stop = true;
+    }
+  };
+
+  if (threads <= 1) {
+    worker();
+  } else {
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; ++t) {
+      pool.emplace_back(worker);
+    }
+    for (auto &t : pool) {
+      t.join();
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+template <typename MakeGenerator>
+void output_random_strings_mapped(MakeGenerator make_generator,
+                                  const Charset &charset, size_t length,
+                                  uint64_t count, uint64_t per_line,
+                                  unsigned threads, char *out) {
+  output_random_strings_mapped(make_generator, CharsetTokens(charset, length),
+                               count, per_line, threads, out);
+}
+
+// ---------------------------------------------------------------------------
+// 去重生成（--unique）
+// ---------------------------------------------------------------------------
+
+// 把令牌编码为定长键。单一字符集时按字符索引位打包（每字符 ceil(log2 n)
+// 位，62 字符集 32 位长的令牌只占 24 字节）；模板时为令牌字节，补零到最大
+// 长度。
+class TokenKeyEncoder {
+public:
+  TokenKeyEncoder(const Charset &charset, size_t length);
+  explicit TokenKeyEncoder(size_t max_bytes);
+
+  size_t key_bytes() const { return key_bytes_; }
+
+  // 编码到 key（key_bytes() 字节）；令牌不可能由该字符集与长度生成（长度
+  // 不符、含字符集外的字符）时返回 false
+  bool encode(std::string_view token, unsigned char *key) const;
+
+private:
+  const Charset *charset_ = nullptr; // 为空时按字节编码
+  size_t length_ = 0;
+  unsigned bits_ = 0;
+  size_t key_bytes_ = 0;
+  std::vector<int32_t> byte_index_;                  // 单字节字符集：字节 → 索引
+  std::vector<std::pair<uint64_t, uint32_t>> index_; // 其余：打包字符 → 索引
+};
+
+// 去重表：开放寻址（线性探测），键为定长字节串，依次存放在每个分片连续的
+// arena 中；槽位只存 32 位哈希标签与 32 位键序号（8 字节）。按哈希高位分片，
+// 每个分片一把锁，多线程插入时互不阻塞。析构时擦除全部键。
+class UniqueTable {
+public:
+  // expected 为预计插入的键数，用于预先分配 arena 与槽位
+  UniqueTable(size_t key_bytes, uint64_t expected, unsigned shards);
+  ~UniqueTable();
+
+  UniqueTable(const UniqueTable &) = delete;
+  UniqueTable &operator=(const UniqueTable &) = delete;
+
+  // 插入一个键；已存在时返回 false 并计入 duplicates()
+  bool insert(const unsigned char *key);
+
+  uint64_t size() const;
+  uint64_t memory_bytes() const;
+  uint64_t duplicates() const {
+    return duplicates_.load(std::memory_order_relaxed);
+  }
+  size_t key_bytes() const { return key_bytes_; }
+
+private:
+  struct Shard {
+    std::mutex mutex;
+    std::vector<uint64_t> slots; // 0 为空，否则 (标签 << 32) | (序号 + 1)
+    std::vector<unsigned char> arena;
+    uint64_t used = 0;
+  };
+
+  size_t key_bytes_;
+  unsigned shard_bits_ = 0;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<uint64_t> duplicates_{0};
+
+  uint64_t hash(const unsigned char *key) const;
+  void grow(Shard &shard);
+};
+
+// 令牌来源的去重包装：每生成一个令牌就插入 table，重复则在原位置重新生成，
+// 因此单线程、多线程与映射输出都自动得到互不相同的令牌
+template <typename Source> class UniqueTokens {
+public:
+  UniqueTokens(const Source &source, const TokenKeyEncoder &encoder,
+               UniqueTable &table)
+      : source_(source), encoder_(encoder), table_(table) {}
+
+  size_t max_bytes() const { return source_.max_bytes(); }
+  bool fixed_size() const { return source_.fixed_size(); }
+  std::string alphabet() const { return source_.alphabet(); }
+
+  class Writer {
+  public:
+    explicit Writer(const UniqueTokens &unique)
+        : inner_(unique.source_.writer()), encoder_(unique.encoder_),
+          table_(unique.table_), key_(unique.encoder_.key_bytes()) {}
+
+    ~Writer() { secure_wipe(key_.data(), key_.size()); }
+
+    template <typename Generator>
+    char *write(char *out, Generator &generator) {
+      for (;;) {
+        char *end = inner_.write(out, generator);
+        if (!encoder_.encode(std::string_view(out, static_cast<size_t>(end - out)),
+                             key_.data())) {
+          throw std::logic_error("生成的令牌无法编码为去重键");
+        }
+        if (table_.insert(key_.data())) {
+          return end;
+        }
+      }
+    }
+
+    void discard() { inner_.discard(); }
+
+  private:
+    decltype(std::declval<const Source &>().writer()) inner_;
+    const TokenKeyEncoder &encoder_;
+    UniqueTable &table_;
+    std::vector<unsigned char> key_;
+  };
+
+  Writer writer() const { return Writer(*this); }
+
+private:
+  const Source &source_;
+  const TokenKeyEncoder &encoder_;
+  UniqueTable &table_;
+};
+
+// 读取令牌文件（如已发放的令牌），按空白切分，对每个令牌调用 f；打不开时
+// 抛出 std::runtime_error
+void for_each_token_in_file(const std::string &path,
+                            const std::function<void(std::string_view)> &f);
+
+// ---------------------------------------------------------------------------
+// 结构化输出格式（--format）
+// ---------------------------------------------------------------------------
+
+enum class OutputFormat {
+  text,   // 空格与换行分隔（默认）
+  nul,    // 每个令牌后跟 '\0'
+  jsonl,  // 每行一个 JSON 字符串
+  csv,    // RFC 4180，-n 为列数
+  binary, // 每个令牌前为 4 字节小端长度，无分隔符
+};
+
+// 按名称（text、nul、jsonl、csv、binary）查找；未知名称时抛出
+// std::invalid_argument
+OutputFormat parse_output_format(std::string_view name);
+
+OutputLayout output_layout(OutputFormat format);
+
+// 字符集令牌的平均字节数：长度乘以字符集中字符的平均字节数
+double average_token_bytes(const Charset &charset, size_t length);
+
+// 估算 count 个令牌的输出总字节数（非流式模式的大小上限据此判断）：每个
+// 令牌按 token_bytes 字节计，jsonl 另加两个引号、binary 另加长度前缀，再加
+// 每个令牌之后的一个分隔符。用浮点数避免超大 count 时溢出
+double estimate_output_bytes(double token_bytes, uint64_t count,
+                             OutputFormat format);
+
+// 需要转义的字节：JSON 字符串中的控制字符、'"' 与 '\'；CSV 字段中的 ','、
+// '"'、'\r' 与 '\n'（出现时整个字段加引号）
+struct EscapeTables {
+  bool json[256] = {};
+  bool csv[256] = {};
+};
+
+constexpr EscapeTables make_escape_tables() {
+  EscapeTables tables;
+  for (int c = 0; c < 0x20; ++c) {
+    tables.json[c] = true;
+  }
+  tables.json['"'] = tables.json['\\'] = true;
+  tables.csv[','] = tables.csv['"'] = true;
+  tables.csv['\r'] = tables.csv['\n'] = true;
+  return tables;
+}
+
+inline constexpr EscapeTables escape_tables = make_escape_tables();
+
+// 把 [data, data + size) 按 JSON 字符串转义写到 out（最多 6 倍），返回写入后
+// 的位置；不含两侧引号
+char *write_json_escaped(const char *data, size_t size, char *out);
+
+// 写出加引号的 CSV 字段（'"' 写作 '""'，最多 2 * size + 2 字节）
+char *write_csv_quoted(const char *data, size_t size, char *out);
+
+// 按输出格式为令牌加框：令牌先照常写到最终位置，只有确实含需要转义的字节
+// 时才把它复制出来转义写回，常见情况下没有额外拷贝。字符集中根本不含
+// 需要转义的字节时令牌仍是定长的，映射输出照常可用。text 与 nul 原样输出。
+template <typename Source> class FramedTokens {
+public:
+  static constexpr size_t LENGTH_PREFIX = 4;
+
+  FramedTokens(const Source &source, OutputFormat format)
+      : source_(source), format_(format) {
+    const bool *table = format == OutputFormat::jsonl ? escape_tables.json
+                        : format == OutputFormat::csv ? escape_tables.csv
+                                                      : nullptr;
+    if (table != nullptr) {
+      for (char c : source.alphabet()) {
+        escapable_ = escapable_ || table[static_cast<unsigned char>(c)];
+      }
+    }
+  }
+
+  size_t max_bytes() const {
+    size_t n = source_.max_bytes();
+    switch (format_) {
+    case OutputFormat::jsonl:
+      return 2 + (escapable_ ? 6 * n : n);
+    case OutputFormat::csv:
+      return escapable_ ? 2 * n + 2 : n;
+    case OutputFormat::binary:
+      return LENGTH_PREFIX + n;
+    default:
+      return n;
+    }
+  }
+  bool fixed_size() const { return source_.fixed_size() && !escapable_; }
+  std::string alphabet() const { return source_.alphabet(); }
+
+  class Writer {
+  public:
+    explicit Writer(const FramedTokens &framed)
+        : inner_(framed.source_.writer()), format_(framed.format_),
+          escapable_(framed.escapable_) {}
+
+    ~Writer() { secure_wipe(scratch_.data(), scratch_.size()); }
+
+    template <typename Generator>
+    char *write(char *out, Generator &generator) {
+      switch (format_) {
+      case OutputFormat::jsonl: {
+        *out = '"';
+        char *end = inner_.write(out + 1, generator);
+        if (escapable_) {
+          end = escape_from(out + 1, end, escape_tables.json,
+                            [](const char *data, size_t size, char *dest) {
+                              return write_json_escaped(data, size, dest);
+                            });
+        }
+        *end = '"';
+        return end + 1;
+      }
+      case OutputFormat::csv: {
+        char *end = inner_.write(out, generator);
+        if (escapable_) {
+          // 需要引号时整个字段重写
+          end = escape_from(out, end, escape_tables.csv,
+                            [](const char *data, size_t size, char *dest) {
+                              return write_csv_quoted(data, size, dest);
+                            },
+                            out);
+        }
+        return end;
+      }
+      case OutputFormat::binary: {
+        char *end = inner_.write(out + LENGTH_PREFIX, generator);
+        uint32_t size = static_cast<uint32_t>(end - out - LENGTH_PREFIX);
+        for (size_t i = 0; i < LENGTH_PREFIX; ++i) {
+          out[i] = static_cast<char>(size >> (8 * i));
+        }
+        return end;
+      }
+      default:
+        return inner_.write(out, generator);
+      }
+    }
+
+    void discard() { inner_.discard(); }
+
+  private:
+    decltype(std::declval<const Source &>().writer()) inner_;
+    OutputFormat format_;
+    bool escapable_;
+    std::string scratch_;
+
+    // [begin, end) 中第一个需要转义的字节起（copy_from 非空时从 copy_from
+    // 起）复制到 scratch_，交给 emit 写回，返回写入后的位置
+    template <typename Emit>
+    char *escape_from(char *begin, char *end, const bool *table, Emit emit,
+                      char *copy_from = nullptr) {
+      char *p = begin;
+      while (p < end && !table[static_cast<unsigned char>(*p)]) {
+        ++p;
+      }
+      if (p == end) {
+        return end;
+      }
+      char *from = copy_from != nullptr ? copy_from : p;
+      scratch_.assign(from, end);
+      char *result = emit(scratch_.data(), scratch_.size(), from);
+      secure_wipe(scratch_.data(), scratch_.size());
+      return result;
+    }
+  };
+
+  Writer writer() const { return Writer(*this); }
+
+private:
+  const Source &source_;
+  OutputFormat format_;
+  bool escapable_ = false;
+};
+
+// 随机数引擎
+enum class EngineKind {
+  system,   // SystemRandomGenerator：每次抽取来自系统熵池
+  chacha20, // ChaCha20Generator：用户态 CSPRNG，种子取自系统调用
+  rdrand,   // HardwareRandomGenerator：RDRAND 指令，不支持时回退到 getrandom
+  rdseed,   // HardwareRandomGenerator：RDSEED 指令，不支持时回退到 getrandom
+};
+
+// 面向嵌入方的令牌生成器：持有字符集、引擎与采样器，构造之后每次生成都只写
+// 调用者的缓冲区，不做堆分配。单个实例不能跨线程共享，每个线程各建一个。
+class TokenGenerator {
+public:
+  explicit TokenGenerator(Charset charset,
+                          EngineKind engine = EngineKind::system);
+  ~TokenGenerator();
+
+  TokenGenerator(TokenGenerator &&) noexcept;
+  TokenGenerator &operator=(TokenGenerator &&) noexcept;
+
+  const Charset &charset() const;
+
+  // 同名自由函数的封装，缓冲区容量要求见 max_token_bytes / max_batch_bytes
+  size_t generate_into(OutputSpan out, size_t length);
+  size_t generate_batch_into(OutputSpan out, size_t length, size_t count,
+                             char separator = '\n');
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+} // namespace randomstr
+
+#endif // RANDOMSTR_HPP
@@ -0,0 +1,604 @@
+// 统计自检（--selftest）：内核一致性比对与流式卡方检验
+#include "selftest.hpp"
+
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+#include "charSet.hpp"
+
+namespace randomstr {
+
+namespace {
+
+constexpr uint64_t SELFTEST_SEED = 0x5e1f7e57; // 内核比对输入与 xoshiro256** 的种子
+constexpr size_t CHUNK_SYMBOLS = 4096;         // 每次写入缓冲区的字符数
+constexpr size_t MAX_PAIR_BUCKETS = 32;        // 序列检验把字符归入的桶数上限
+
+// ---------------------------------------------------------------------------
+// 内核一致性
+// ---------------------------------------------------------------------------
+
+template <typename Info>
+SelftestResult kernel_result(const char *family, const std::vector<Info> &kernels,
+                             size_t inputs, const std::string &mismatch) {
+  SelftestResult result;
+  result.name = std::string("内核 ") + family + " ";
+  for (size_t i = 0; i < kernels.size(); ++i) {
+    result.name += std::string(i == 0 ? "" : "/") + kernels[i].name;
+  }
+  result.passed = mismatch.empty();
+  if (!result.passed) {
+    result.detail = mismatch;
+  } else if (kernels.size() == 1) {
+    result.detail = "仅有标量参考实现";
+  } else {
+    result.detail = std::string("与 ") + kernels.back().name + " 逐字节一致（" +
+                    std::to_string(inputs) + " 组输入）";
+  }
+  return result;
+}
+
+SelftestResult check_chacha20_kernels() {
+  const std::vector<ChaCha20KernelInfo> kernels = chacha20_kernels();
+  const ChaCha20KernelInfo &reference = kernels.back();
+  static constexpr size_t BLOCKS[] = {1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 33, 64};
+  Xoshiro256Generator rng(SELFTEST_SEED);
+  std::vector<unsigned char> expected;
+  std::vector<unsigned char> actual;
+  std::string mismatch;
+  size_t inputs = 0;
+  for (size_t nblocks : BLOCKS) {
+    for (int round = 0; round < 4; ++round, ++inputs) {
+      uint32_t input[16];
+      rng.fill(reinterpret_cast<unsigned char *>(input), sizeof(input));
+      if (round == 3) {
+        input[12] = UINT32_MAX - 2; // 块计数器在批内回绕
+      }
+      expected.assign(nblocks * 64, 0);
+      reference.kernel(input, expected.data(), nblocks);
+      for (size_t k = 0; k + 1 < kernels.size() && mismatch.empty(); ++k) {
+        actual.assign(nblocks * 64, 0);
+        kernels[k].kernel(input, actual.data(), nblocks);
+        if (actual != expected) {
+          mismatch = std::string(kernels[k].name) + " 生成 " +
+                     std::to_string(nblocks) + " 块时输出不同";
+        }
+      }
+    }
+  }
+  return kernel_result("ChaCha20", kernels, inputs, mismatch);
+}
+
+// 字符表取互不相同的可见字符，与字符集的实际内容无关
+AsciiTable kernel_table(unsigned size) {
+  AsciiTable table;
+  table.size = size;
+  unsigned mask = 1;
+  while (mask < size) {
+    mask <<= 1;
+  }
+  table.mask = static_cast<unsigned char>(mask - 1);
+  for (unsigned i = 0; i < 128; ++i) {
+    table.symbols[i] = static_cast<unsigned char>(i < 94 ? '!' + i : i);
+  }
+  return table;
+}
+
+SelftestResult check_ascii_kernels() {
+  const std::vector<AsciiKernelInfo> kernels = ascii_kernels();
+  const AsciiKernelInfo &reference = kernels.back();
+  static constexpr unsigned SIZES[] = {2,  3,  10, 16, 26,  36,  62,
+                                       64, 85, 94, 100, 127, 128};
+  static constexpr size_t LENGTHS[] = {0,  1,  15,  16,   17,  31,
+                                       32, 33, 100, 1000, 4096};
+  Xoshiro256Generator rng(SELFTEST_SEED);
+  std::vector<unsigned char> random;
+  std::vector<unsigned char> expected;
+  std::vector<unsigned char> actual;
+  std::string mismatch;
+  size_t inputs = 0;
+  for (unsigned size : SIZES) {
+    const AsciiTable table = kernel_table(size);
+    for (size_t length : LENGTHS) {
+      random.assign(length + 1, 0);
+      rng.fill(random.data(), length);
+      expected.assign(length + ASCII_KERNEL_SLACK, 0);
+      size_t produced =
+          reference.kernel(random.data(), length, expected.data(), table);
+      for (size_t k = 0; k + 1 < kernels.size() && mismatch.empty(); ++k) {
+        actual.assign(length + ASCII_KERNEL_SLACK, 0);
+        if (kernels[k].kernel(random.data(), length, actual.data(), table) !=
+                produced ||
+            std::memcmp(actual.data(), expected.data(), produced) != 0) {
+          mismatch = std::string(kernels[k].name) + " 在 " +
+                     std::to_string(size) + " 个字符、" +
+                     std::to_string(length) + " 个随机字节时输出不同";
+        }
+      }
+      ++inputs;
+    }
+  }
+  return kernel_result("ASCII", kernels, inputs, mismatch);
+}
+
+SelftestResult check_pow2_kernels() {
+  const std::vector<Pow2KernelInfo> kernels = pow2_kernels();
+  const Pow2KernelInfo &reference = kernels.back();
+  // 各实现只在字符数为 16 的倍数时保证输出相同
+  static constexpr size_t SYMBOLS[] = {16, 32, 48, 160, 4096};
+  Xoshiro256Generator rng(SELFTEST_SEED);
+  std::vector<unsigned char> random;
+  std::vector<unsigned char> expected;
+  std::vector<unsigned char> actual;
+  std::string mismatch;
+  size_t inputs = 0;
+  for (unsigned bits = 1; bits <= 7; ++bits) {
+    const AsciiTable table = kernel_table(1u << bits);
+    for (size_t symbols : SYMBOLS) {
+      random.assign(symbols * bits / 8 + 8, 0);
+      rng.fill(random.data(), random.size());
+      expected.assign(symbols, 0);
+      reference.kernel(random.data(), symbols, bits, expected.data(), table);
+      for (size_t k = 0; k + 1 < kernels.size() && mismatch.empty(); ++k) {
+        actual.assign(symbols, 0);
+        kernels[k].kernel(random.data(), symbols, bits, actual.data(), table);
+        if (actual != expected) {
+          mismatch = std::string(kernels[k].name) + " 在 " +
+                     std::to_string(bits) + " 位、" + std::to_string(symbols) +
+                     " 个字符时输出不同";
+        }
+      }
+      ++inputs;
+    }
+  }
+  return kernel_result("2 的幂", kernels, inputs, mismatch);
+}
+
+// ---------------------------------------------------------------------------
+// 分布检验
+// ---------------------------------------------------------------------------
+
+struct CharsetCase {
+  std::string name;
+  Charset charset;
+  std::vector<double> probability;      // 各字符的理论概率
+  std::vector<uint32_t> bucket;         // 字符 -> 序列检验的桶
+  size_t buckets = 0;
+  std::vector<double> pair_probability; // 桶对 (a, b) 的理论概率
+  std::vector<int32_t> index_of;        // 码点 -> 字符索引，不在字符集中为 -1
+};
+
+uint32_t decode_code_point(const unsigned char *p, size_t length) {
+  uint32_t cp = length == 1 ? p[0] : p[0] & (0x7Fu >> length);
+  for (size_t i = 1; i < length; ++i) {
+    cp = cp << 6 | (p[i] & 0x3Fu);
+  }
+  return cp;
+}
+
+CharsetCase make_case(std::string name, Charset charset,
+                      const std::vector<uint64_t> &weights = {}) {
+  CharsetCase c;
+  c.name = std::move(name);
+  c.charset = std::move(charset);
+  const size_t n = c.charset.size();
+  if (!weights.empty()) {
+    c.charset.set_weights(weights);
+  }
+  double total = 0;
+  for (uint64_t weight : weights) {
+    total += static_cast<double>(weight);
+  }
+  c.probability.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    c.probability[i] = weights.empty() ? 1.0 / static_cast<double>(n)
+                                       : static_cast<double>(weights[i]) / total;
+  }
+
+  c.buckets = std::min(n, MAX_PAIR_BUCKETS);
+  c.bucket.resize(n);
+  std::vector<double> bucket_probability(c.buckets);
+  for (size_t i = 0; i < n; ++i) {
+    c.bucket[i] = static_cast<uint32_t>(i * c.buckets / n);
+    bucket_probability[c.bucket[i]] += c.probability[i];
+  }
+  c.pair_probability.resize(c.buckets * c.buckets);
+  for (size_t a = 0; a < c.buckets; ++a) {
+    for (size_t b = 0; b < c.buckets; ++b) {
+      c.pair_probability[a * c.buckets + b] =
+          bucket_probability[a] * bucket_probability[b];
+    }
+  }
+
+  std::vector<uint32_t> code_points(n);
+  uint32_t max_cp = 0;
+  for (size_t i = 0; i < n; ++i) {
+    std::string_view ch = c.charset.at(i);
+    code_points[i] = decode_code_point(
+        reinterpret_cast<const unsigned char *>(ch.data()), ch.size());
+    max_cp = std::max(max_cp, code_points[i]);
+  }
+  c.index_of.assign(max_cp + 1, -1);
+  for (size_t i = 0; i < n; ++i) {
+    c.index_of[code_points[i]] = static_cast<int32_t>(i);
+  }
+  return c;
+}
+
+// 覆盖每条采样路径：ascii_simd（含高拒绝率的 94 字符）、单字节与多字节的
+// pow2、等宽与不等宽的 lemire，以及带权字符集的 alias
+std::vector<CharsetCase> charset_cases() {
+  std::vector<CharsetCase> cases;
+  cases.push_back(make_case("dn+en", build_charset("", {"dn", "en"})));
+  cases.push_back(make_case("dn+en+sp", build_charset("", {"dn", "en", "sp"})));
+  cases.push_back(make_case("hex", build_charset("0123456789abcdef", {})));
+  cases.push_back(make_case(
+      "base64",
+      build_charset(
+          "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/",
+          {})));
+  const Charset zh = build_charset("", {"zh"});
+  std::vector<std::string> head;
+  for (size_t i = 0; i < 256 && i < zh.size(); ++i) {
+    head.emplace_back(zh.at(i));
+  }
+  cases.push_back(make_case("zh 前 256 字", Charset(head)));
+  cases.push_back(make_case("zh", zh));
+  cases.push_back(make_case("dn+zh", build_charset("", {"dn", "zh"})));
+  std::vector<uint64_t> weights;
+  for (uint64_t w = 1; w <= 20; ++w) {
+    weights.push_back(w);
+  }
+  cases.push_back(
+      make_case("a-t 权重 1..20", build_charset("abcdefghijklmnopqrst", {}),
+                weights));
+  return cases;
+}
+
+// 单个线程的计数；字符对取生成顺序上不重叠的相邻两个字符
+struct Tally {
+  std::vector<uint64_t> symbols;
+  std::vector<uint64_t> pairs;
+  uint64_t foreign = 0; // 无法识别为字符集字符的输出段数
+  int64_t pending = -1; // 等待配对的前一个字符
+
+  explicit Tally(const CharsetCase &c)
+      : symbols(c.charset.size()), pairs(c.buckets * c.buckets) {}
+
+  void add(const CharsetCase &c, uint32_t index) {
+    ++symbols[index];
+    if (pending < 0) {
+      pending = index;
+    } else {
+      ++pairs[c.bucket[pending] * c.buckets + c.bucket[index]];
+      pending = -1;
+    }
+  }
+
+  void merge(const Tally &other) {
+    for (size_t i = 0; i < symbols.size(); ++i) {
+      symbols[i] += other.symbols[i];
+    }
+    for (size_t i = 0; i < pairs.size(); ++i) {
+      pairs[i] += other.pairs[i];
+    }
+    foreign += other.foreign;
+  }
+};
+
+// 被测路径：CharsetSampler 写入固定缓冲区，再逐字符解码回索引计数
+template <typename Generator>
+void tally_sampler(const CharsetCase &c, uint64_t symbols, Generator &generator,
+                   Tally &tally) {
+  CharsetSampler sampler(c.charset);
+  std::vector<char> buffer(CHUNK_SYMBOLS * c.charset.max_width());
+  for (uint64_t done = 0; done < symbols;) {
+    const size_t n =
+        static_cast<size_t>(std::min<uint64_t>(CHUNK_SYMBOLS, symbols - done));
+    const auto *p = reinterpret_cast<const unsigned char *>(buffer.data());
+    const auto *end = reinterpret_cast<const unsigned char *>(
+        sampler.write(buffer.data(), n, generator));
+    size_t decoded = 0;
+    while (p < end) {
+      const size_t length = utf8_char_length(*p);
+      int32_t index = -1;
+      if ((*p & 0xC0) != 0x80 && length <= static_cast<size_t>(end - p)) {
+        uint32_t cp = decode_code_point(p, length);
+        index = cp < c.index_of.size() ? c.index_of[cp] : -1;
+      }
+      if (index < 0 ||
+          c.charset.at(index) !=
+              std::string_view(reinterpret_cast<const char *>(p), length)) {
+        ++tally.foreign;
+        return;
+      }
+      tally.add(c, static_cast<uint32_t>(index));
+      p += length;
+      ++decoded;
+    }
+    if (decoded != n) {
+      ++tally.foreign;
+      return;
+    }
+    done += n;
+  }
+}
+
+// 参考路径：不经缓冲与向量内核，逐个 IndexSampler 抽取（带权时再掷别名表
+// 的硬币）
+template <typename Generator>
+void tally_reference(const CharsetCase &c, uint64_t symbols,
+                     Generator &generator, Tally &tally) {
+  const AliasTable *alias = c.charset.alias();
+  IndexSampler column(c.charset.size());
+  IndexSampler coin(alias != nullptr ? alias->total() : 1);
+  for (uint64_t i = 0; i < symbols; ++i) {
+    uint32_t index = column.next(generator);
+    if (alias != nullptr) {
+      index = alias->pick(index, coin.next(generator));
+    }
+    tally.add(c, index);
+  }
+}
+
+// symbols 个字符平分给各线程，每个线程用自己的引擎实例（xoshiro256** 各取
+// 一个随机流）与计数，最后合并
+template <typename MakeGenerator, typename Work>
+Tally tally_parallel(const CharsetCase &c, uint64_t symbols, unsigned threads,
+                     MakeGenerator make_generator, Work work) {
+  std::vector<Tally> tallies(threads, Tally(c));
+  std::vector<std::exception_ptr> errors(threads);
+  auto run = [&](unsigned worker) {
+    try {
+      auto generator = make_generator();
+      if constexpr (is_stream_generator<decltype(generator)>::value) {
+        generator.select_stream(worker);
+      }
+      uint64_t share = symbols / threads + (worker < symbols % threads ? 1 : 0);
+      work(c, share, generator, tallies[worker]);
+    } catch (...) {
+      errors[worker] = std::current_exception();
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned worker = 1; worker < threads; ++worker) {
+    workers.emplace_back(run, worker);
+  }
+  run(0);
+  for (auto &thread : workers) {
+    thread.join();
+  }
+  for (const auto &error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+  for (unsigned worker = 1; worker < threads; ++worker) {
+    tallies[0].merge(tallies[worker]);
+  }
+  return std::move(tallies[0]);
+}
+
+// Wilson–Hilferty：自由度为 df 的卡方统计量换算为近似标准正态分数
+double chi_square_z(double chi2, double df) {
+  if (df <= 0) {
+    return 0;
+  }
+  const double h = 2.0 / (9.0 * df);
+  return (std::cbrt(chi2 / df) - (1.0 - h)) / std::sqrt(h);
+}
+
+// 拟合优度：观测频数对理论概率
+double fit_z(const std::vector<uint64_t> &observed,
+             const std::vector<double> &probability) {
+  double total = 0;
+  for (uint64_t count : observed) {
+    total += static_cast<double>(count);
+  }
+  double chi2 = 0;
+  for (size_t i = 0; i < observed.size(); ++i) {
+    const double expected = total * probability[i];
+    const double delta = static_cast<double>(observed[i]) - expected;
+    chi2 += delta * delta / expected;
+  }
+  return chi_square_z(chi2, static_cast<double>(observed.size()) - 1);
+}
+
+// 同质性：两组观测频数是否来自同一分布（样本量可以不同）
+double homogeneity_z(const std::vector<uint64_t> &a,
+                     const std::vector<uint64_t> &b) {
+  double total_a = 0;
+  double total_b = 0;
+  for (size_t i = 0; i < a.size(); ++i) {
+    total_a += static_cast<double>(a[i]);
+    total_b += static_cast<double>(b[i]);
+  }
+  const double scale_a = std::sqrt(total_b / total_a);
+  const double scale_b = std::sqrt(total_a / total_b);
+  double chi2 = 0;
+  double bins = 0;
+  for (size_t i = 0; i < a.size(); ++i) {
+    const double sum = static_cast<double>(a[i] + b[i]);
+    if (sum > 0) {
+      const double delta = static_cast<double>(a[i]) * scale_a -
+                           static_cast<double>(b[i]) * scale_b;
+      chi2 += delta * delta / sum;
+      bins += 1;
+    }
+  }
+  return chi_square_z(chi2, bins - 1);
+}
+
+std::string format_z(const char *label, double z) {
+  std::ostringstream text;
+  text << label << " z=" << std::showpos << std::fixed << std::setprecision(2)
+       << z;
+  return text.str();
+}
+
+// 各项 z 超出阈值的列出来；都在阈值之内返回空串
+std::string judge(const std::vector<std::pair<const char *, double>> &scores,
+                  double max_z, std::string &summary) {
+  std::string failures;
+  for (const auto &[label, z] : scores) {
+    summary += (summary.empty() ? "" : " ") + format_z(label, z);
+    if (!(std::fabs(z) <= max_z)) {
+      failures += (failures.empty() ? "" : "，") + format_z(label, z);
+    }
+  }
+  return failures;
+}
+
+void describe_run(SelftestResult &result, uint64_t symbols,
+                  std::chrono::steady_clock::time_point start) {
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  std::ostringstream text;
+  text << "，" << symbols << " 字符 " << std::fixed << std::setprecision(2)
+       << seconds << " 秒";
+  result.detail += text.str();
+}
+
+struct EngineCase {
+  std::string name;
+  EngineKind kind;
+  bool seeded;       // 为 true 时使用 Xoshiro256Generator
+  uint64_t divisor;  // 慢速引擎只生成 symbols / divisor 个字符
+};
+
+template <typename Fn> void with_engine(const EngineCase &engine, Fn &&fn) {
+  if (engine.seeded) {
+    fn([] { return Xoshiro256Generator(SELFTEST_SEED); });
+  } else if (engine.kind == EngineKind::chacha20) {
+    fn([] { return ChaCha20Generator(); });
+  } else if (engine.kind == EngineKind::rdrand ||
+             engine.kind == EngineKind::rdseed) {
+    const HardwareInstruction instruction = engine.kind == EngineKind::rdrand
+                                                ? HardwareInstruction::rdrand
+                                                : HardwareInstruction::rdseed;
+    fn([instruction] { return HardwareRandomGenerator(instruction); });
+  } else {
+    fn([] { return SystemRandomGenerator(); });
+  }
+}
+
+SelftestResult check_reference(const CharsetCase &c, const Tally &tally,
+                               uint64_t symbols, double max_z,
+                               std::chrono::steady_clock::time_point start) {
+  SelftestResult result;
+  result.name = "参考路径 / " + c.name + " (" +
+                std::to_string(c.charset.size()) + " 个字符)";
+  std::string failures = judge({{"拟合", fit_z(tally.symbols, c.probability)},
+                                {"序列", fit_z(tally.pairs, c.pair_probability)}},
+                               max_z, result.detail);
+  result.passed = failures.empty();
+  if (!result.passed) {
+    result.detail = "偏离理论分布: " + failures;
+  }
+  describe_run(result, symbols, start);
+  return result;
+}
+
+SelftestResult check_distribution(const EngineCase &engine,
+                                  const CharsetCase &c, const Tally &reference,
+                                  const SelftestOptions &options) {
+  const auto start = std::chrono::steady_clock::now();
+  SelftestResult result;
+  result.name = engine.name + " / " + c.name + " (" +
+                CharsetSampler(c.charset).path_name() + ")";
+  const uint64_t symbols =
+      std::max(options.symbols / engine.divisor,
+               std::min(options.symbols, SelftestOptions::MIN_SYMBOLS));
+  try {
+    Tally tally(c);
+    with_engine(engine, [&](auto make_generator) {
+      tally = tally_parallel(
+          c, symbols, options.threads, make_generator,
+          [](const CharsetCase &target, uint64_t n, auto &generator,
+             Tally &t) { tally_sampler(target, n, generator, t); });
+    });
+    if (tally.foreign > 0) {
+      result.detail = "输出了字符集之外的字节或字符数不符";
+      return result;
+    }
+    std::string failures =
+        judge({{"拟合", fit_z(tally.symbols, c.probability)},
+               {"序列", fit_z(tally.pairs, c.pair_probability)},
+               {"对照", homogeneity_z(tally.symbols, reference.symbols)}},
+              options.max_z, result.detail);
+    result.passed = failures.empty();
+    if (!result.passed) {
+      result.detail = "超出 ±" + std::to_string(static_cast<int>(options.max_z)) +
+                      " 的阈值: " + failures;
+    }
+  } catch (const std::exception &e) {
+    result.detail = e.what();
+    return result;
+  }
+  describe_run(result, symbols, start);
+  return result;
+}
+
+} // namespace
+
+uint64_t run_selftest(const SelftestOptions &options,
+                      const std::function<void(const SelftestResult &)> &report) {
+  uint64_t failed = 0;
+  auto emit = [&](const SelftestResult &result) {
+    failed += !result.passed && !result.skipped ? 1 : 0;
+    report(result);
+  };
+  const unsigned threads = std::max(1u, options.threads);
+
+  emit(check_chacha20_kernels());
+  emit(check_ascii_kernels());
+  emit(check_pow2_kernels());
+
+  // 参考直方图：system 引擎、逐个抽取，先与理论分布比对，再作为各引擎的对照
+  const std::vector<CharsetCase> cases = charset_cases();
+  std::vector<Tally> references;
+  for (const CharsetCase &c : cases) {
+    const auto start = std::chrono::steady_clock::now();
+    references.push_back(tally_parallel(
+        c, options.symbols, threads, [] { return SystemRandomGenerator(); },
+        [](const CharsetCase &target, uint64_t n, auto &generator, Tally &t) {
+          tally_reference(target, n, generator, t);
+        }));
+    emit(check_reference(c, references.back(), options.symbols, options.max_z,
+                         start));
+  }
+
+  const std::vector<EngineCase> engines = {
+      {"system", EngineKind::system, false, 1},
+      {std::string("chacha20 (") + chacha20_kernel().name + ")",
+       EngineKind::chacha20, false, 1},
+      {"xoshiro256**", EngineKind::system, true, 1},
+      {"rdrand", EngineKind::rdrand, false, 1},
+      {"rdseed", EngineKind::rdseed, false, 16}, // 约 10 MB/s，按比例缩短
+  };
+  SelftestOptions run_options = options;
+  run_options.threads = threads;
+  for (const EngineCase &engine : engines) {
+    if (engine.kind == EngineKind::rdrand || engine.kind == EngineKind::rdseed) {
+      const char *reason = hardware_random_unavailable(
+          engine.kind == EngineKind::rdrand ? HardwareInstruction::rdrand
+                                            : HardwareInstruction::rdseed);
+      if (reason != nullptr) {
+        SelftestResult result;
+        result.name = engine.name;
+        result.skipped = true;
+        result.detail = reason;
+        emit(result);
+        continue;
+      }
+    }
+    for (size_t i = 0; i < cases.size(); ++i) {
+      emit(check_distribution(engine, cases[i], references[i], run_options));
+    }
+  }
+  return failed;
+}
+
+} // namespace randomstr
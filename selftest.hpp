@@ -0,0 +1,43 @@
+// 统计自检（--selftest）：验证各引擎、采样路径与向量化内核的输出
+//
+// 两类检验：
+//  1. 内核一致性：当前 CPU 上可用的每个 ChaCha20、ASCII 与 2 的幂内核都与
+//     标量参考实现逐字节比较，相同输入必须得到完全相同的输出；
+//  2. 分布检验：每个引擎 × 每条采样路径流式生成 symbols 个字符，做三项
+//     卡方检验——按字符计数的拟合优度、不重叠相邻字符对的序列相关，以及与
+//     参考路径（system 引擎逐个 IndexSampler 抽取）直方图的同质性。
+//
+// 生成在固定大小的缓冲区里进行、当场计数，内存只与字符集大小有关，与
+// symbols 无关；各线程独立生成，最后合并计数。
+#ifndef SELFTEST_HPP
+#define SELFTEST_HPP
+
+#include "randomstr.hpp"
+
+namespace randomstr {
+
+struct SelftestOptions {
+  static constexpr uint64_t DEFAULT_SYMBOLS = uint64_t{1} << 24;
+  // 低于此数时字符对的期望频数太小，卡方近似失效
+  static constexpr uint64_t MIN_SYMBOLS = uint64_t{1} << 20;
+
+  uint64_t symbols = DEFAULT_SYMBOLS; // 每项分布检验的字符数
+  unsigned threads = 1;
+  // 卡方统计量换算成标准正态分数后允许的最大绝对值（5 约对应 p < 6e-7）
+  double max_z = 5.0;
+};
+
+struct SelftestResult {
+  std::string name;
+  bool passed = false;
+  bool skipped = false; // 引擎在本机不可用
+  std::string detail;
+};
+
+// 依次执行全部检验，每完成一项调用一次 report；返回失败的项数
+uint64_t run_selftest(const SelftestOptions &options,
+                      const std::function<void(const SelftestResult &)> &report);
+
+} // namespace randomstr
+
+#endif // SELFTEST_HPP
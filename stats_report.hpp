@@ -0,0 +1,148 @@
+// --stats 报告：分阶段计时与统计项，输出为纯文本或 JSON（写到标准错误）
+//
+// 未开启 --stats 时 PhaseTimer 不读时钟，mark() 只是一次分支判断。
+#ifndef STATS_REPORT_HPP
+#define STATS_REPORT_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+// 进程 CPU 时间（所有线程之和），单位秒
+inline double process_cpu_seconds() {
+#if defined(_WIN32)
+  return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#else
+  timespec ts{};
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return static_cast<double>(ts.tv_sec) + ts.tv_nsec / 1e9;
+#endif
+}
+
+struct PhaseTiming {
+  std::string key;   // JSON 键
+  std::string label; // 文本标签
+  double wall_seconds = 0;
+  double cpu_seconds = 0;
+};
+
+// 依次记录 main 的各个阶段：每次 mark() 结束上一阶段并开始下一阶段
+class PhaseTimer {
+public:
+  // 第一个阶段的墙钟时间从 start 算起，CPU 时间从进程启动算起
+  PhaseTimer(bool enabled, std::chrono::steady_clock::time_point start)
+      : enabled_(enabled), wall_start_(start) {}
+
+  void mark(const char *key, const char *label) {
+    if (!enabled_) {
+      return;
+    }
+    auto wall_now = std::chrono::steady_clock::now();
+    double cpu_now = process_cpu_seconds();
+    phases_.push_back(
+        {key, label,
+         std::chrono::duration<double>(wall_now - wall_start_).count(),
+         cpu_now - cpu_start_});
+    wall_start_ = wall_now;
+    cpu_start_ = cpu_now;
+  }
+
+  bool enabled() const { return enabled_; }
+  const std::vector<PhaseTiming> &phases() const { return phases_; }
+
+private:
+  bool enabled_;
+  std::chrono::steady_clock::time_point wall_start_{};
+  double cpu_start_ = 0;
+  std::vector<PhaseTiming> phases_;
+};
+
+// 有序的统计项列表
+class StatsReport {
+public:
+  void add(const std::string &key, const std::string &label, double value,
+           const std::string &unit = "") {
+    items_.push_back({key, label, format_number(value), unit, false});
+  }
+  void add(const std::string &key, const std::string &label, uint64_t value,
+           const std::string &unit = "") {
+    items_.push_back({key, label, std::to_string(value), unit, false});
+  }
+  void add(const std::string &key, const std::string &label,
+           const std::string &value) {
+    items_.push_back({key, label, value, "", true});
+  }
+
+  void print_text(std::ostream &os,
+                  const std::vector<PhaseTiming> &phases) const {
+    os << "---\n";
+    if (!phases.empty()) {
+      os << "阶段耗时 (墙钟 / CPU):\n";
+      for (const auto &phase : phases) {
+        os << "  " << phase.label << ": " << format_number(phase.wall_seconds)
+           << " 秒 / " << format_number(phase.cpu_seconds) << " 秒\n";
+      }
+    }
+    for (const auto &item : items_) {
+      os << item.label << ": " << item.value;
+      if (!item.unit.empty()) {
+        os << " " << item.unit;
+      }
+      os << "\n";
+    }
+  }
+
+  void print_json(std::ostream &os,
+                  const std::vector<PhaseTiming> &phases) const {
+    os << "{\"phases\":[";
+    for (size_t i = 0; i < phases.size(); ++i) {
+      os << (i > 0 ? "," : "") << "{\"name\":" << quote(phases[i].key)
+         << ",\"wall_seconds\":" << format_number(phases[i].wall_seconds)
+         << ",\"cpu_seconds\":" << format_number(phases[i].cpu_seconds)
+         << "}";
+    }
+    os << "]";
+    for (const auto &item : items_) {
+      os << "," << quote(item.key) << ":"
+         << (item.is_string ? quote(item.value) : item.value);
+    }
+    os << "}\n";
+  }
+
+private:
+  struct Item {
+    std::string key;
+    std::string label;
+    std::string value;
+    std::string unit;
+    bool is_string;
+  };
+  std::vector<Item> items_;
+
+  static std::string format_number(double value) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.6g", value);
+    return buffer;
+  }
+
+  static std::string quote(const std::string &value) {
+    std::string quoted = "\"";
+    for (char c : value) {
+      if (c == '"' || c == '\\') {
+        quoted += '\\';
+      }
+      quoted += c;
+    }
+    return quoted + "\"";
+  }
+};
+
+#endif // STATS_REPORT_HPP
@@ -1,239 +1,129 @@
 #include <algorithm>
-#include <cerrno>
+#include <chrono>
 #include <cmath>
-#include <cstring>
-#include <fstream>
 #include <iostream>
-#include <random>
-#include <sstream>
+#include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
 #ifdef _WIN32
-// 以下行的作用是
-#ifndef WINAPI 
-#include <windows.h>
-#else 
-#include <bcrypt.h>
-#endif
-// 这两部分都有用
-#ifndef WINAPI 
-#include <windows.h>
-#else 
-#include <bcrypt.h>
-#endif
-// 保证bcrypt.h 在windows .h后被引入
-#ifndef STATUS_SUCCESS
-#define STATUS_SUCCESS ((NTSTATUS)0x00000000L)
-#endif
-#ifdef _MSC_VER
-#pragma comment(lib, "Bcrypt.lib")
+#include <io.h>
+#ifndef STDOUT_FILENO
+#define STDOUT_FILENO 1
 #endif
 #else
-#include <fcntl.h>
-#include <sys/random.h>
+#include <csignal>
 #include <unistd.h>
 #endif
 
-#include "CLI11.hpp"   // 引入 CLI11 库
-#include "charSet.hpp" // 引入默认字符集定义
-
-const std::string VERSION = "3.3.3";
-const std::string DEFAULT_CHARSET_nw =
-    std::string(digit_nw /*win11中有这个变量名 _nw表示no=window */) +
-    std::string(en_nw /*win11中有这个变量名 _nw表示no=window */);
-
-// 大小限制常量
-const size_t MAX_OUTPUT_SIZE = 10 * 1024 * 1024; // 10 MB
-const size_t CHUNK_SIZE = 1024;                  // 1 KB
-
-// 使用系统调用获取密码学安全的随机数（Linux: getrandom/urandom；Windows:
-// BCryptGenRandom）
-class SystemRandomGenerator {
-public:
-  using result_type = uint64_t;
-
-  SystemRandomGenerator() = default;
-
-  template <typename T = uint64_t> T operator()() {
-    T value{};
-    fill_random_bytes(reinterpret_cast<unsigned char *>(&value), sizeof(T));
-    return value;
-  }
-
-  static constexpr uint64_t min() { return 0; }
-  static constexpr uint64_t max() { return UINT64_MAX; }
-
-private:
-  // 先尝试 getrandom；若内核不支持则回落到 /dev/urandom；Windows 使用
-  // BCryptGenRandom
-  static void fill_random_bytes(unsigned char *buffer, size_t size) {
-#ifdef _WIN32
-    NTSTATUS status = BCryptGenRandom(nullptr, buffer, static_cast<ULONG>(size),
-                                      BCRYPT_USE_SYSTEM_PREFERRED_RNG);
-    if (status != STATUS_SUCCESS) {
-      throw std::runtime_error("BCryptGenRandom 失败");
-    }
-#else
-    size_t filled = 0;
-    while (filled < size) {
-      ssize_t ret = getrandom(buffer + filled, size - filled, GRND_NONBLOCK);
-      if (ret < 0) {
-        if (errno == EINTR) {
-          continue; // 被信号中断，重试
-        }
-        if (errno == ENOSYS) {
-          fill_from_urandom(buffer + filled, size - filled);
-          return;
-        }
-        throw std::runtime_error("getrandom 失败: " +
-                                 std::string(std::strerror(errno)));
-      }
-      filled += static_cast<size_t>(ret);
-    }
-#endif
-  }
+#include "CLI11.hpp"     // 引入 CLI11 库
+#include "jobs.hpp"
+#include "randomstr.hpp" // 引入 librandomstr
+#include "selftest.hpp"
+#include "stats_report.hpp"
+#include "token_server.hpp"
 
-#ifndef _WIN32
-  static void fill_from_urandom(unsigned char *buffer, size_t size) {
-    int fd = open("/dev/urandom", O_RDONLY);
-    if (fd < 0) {
-      throw std::runtime_error("无法打开 /dev/urandom: " +
-                               std::string(std::strerror(errno)));
-    }
-
-    size_t read_bytes = 0;
-    while (read_bytes < size) {
-      ssize_t ret = read(fd, buffer + read_bytes, size - read_bytes);
-      if (ret < 0) {
-        if (errno == EINTR) {
-          continue; // 被信号中断，重试
-        }
-        close(fd);
-        throw std::runtime_error("读取 /dev/urandom 失败: " +
-                                 std::string(std::strerror(errno)));
-      }
-      if (ret == 0) {
-        close(fd);
-        throw std::runtime_error("读取 /dev/urandom 意外返回 0 字节");
-      }
-      read_bytes += static_cast<size_t>(ret);
-    }
+using namespace randomstr;
 
-    close(fd);
-  }
-#endif
-};
-
-// 将 UTF-8 字符串拆分为单个字符（字符串向量）
-std::vector<std::string> split_utf8_string(const std::string_view &str) {
-  std::vector<std::string> chars;
-  for (size_t i = 0; i < str.length();) {
-    unsigned char c = static_cast<unsigned char>(str[i]);
-    size_t n = 1;
-
-    // 根据 UTF-8 首字节判断字符长度
-    if ((c & 0x80) == 0)
-      n = 1; // ASCII
-    else if ((c & 0xE0) == 0xC0)
-      n = 2; // 2字节字符
-    else if ((c & 0xF0) == 0xE0)
-      n = 3; // 3字节字符 (汉字通常在这里)
-    else if ((c & 0xF8) == 0xF0)
-      n = 4; // 4字节字符
-
-    // 边界检查，防止非法 UTF-8 导致越界
-    if (i + n > str.length())
-      n = 1;
-
-    chars.emplace_back(str.substr(i, n));
-    i += n;
-  }
-  return chars;
-}
-
-// 函数：从文件读取字符集
-std::string load_charset_from_file(const std::string &filename) {
-  std::ifstream file(filename);
-  if (!file.is_open()) {
-    throw std::runtime_error("无法打开字符集文件: " + filename);
-  }
-
-  // 读取文件所有内容到字符串
-  std::stringstream buffer;
-  buffer << file.rdbuf();
-  std::string charset = buffer.str();
-
-  // 移除空白字符，并确保字符集非空
-  // 修复：使用 lambda 强制转换为 unsigned char，避免 isspace
-  // 处理汉字字节时的未定义行为
-  charset.erase(std::remove_if(charset.begin(), charset.end(),
-                               [](unsigned char c) { return std::isspace(c); }),
-                charset.end());
-
-  if (charset.empty()) {
-    throw std::runtime_error("字符集文件为空或只包含空白字符。");
-  }
-
-  return charset;
-}
-
-// 函数：生成指定长度的随机字符串，使用系统调用的密码学安全随机数生成器
-std::string generate_random_string(size_t length,
-                                   const std::vector<std::string> &charset,
-                                   SystemRandomGenerator &generator) {
-  if (charset.empty()) {
-    return "";
-  }
-
-  // 定义均匀分布
-  // 范围是 [0, charset.size() - 1]
-  std::uniform_int_distribution<size_t> distribution(0, charset.size() - 1);
-
-  std::string random_string;
-  random_string.reserve(length); // 预留空间
-
-  // 循环生成字符串
-  for (size_t i = 0; i < length; ++i) {
-    // 从分布中获取一个随机索引
-    size_t random_index = distribution(generator);
-
-    // 将字符集对应索引的完整字符（string）添加到结果中
-    random_string += charset[random_index];
-  }
+const std::string VERSION = "3.3.3";
 
-  return random_string;
-}
+// 大小限制常量（--stream 模式下不限制）
+const uint64_t MAX_OUTPUT_SIZE = 10 * 1024 * 1024; // 10 MB
 
 // 主函数，处理命令行参数
 int main(int argc, char *argv[]) {
+  // --stats 的第一个阶段从这里算起（墙钟）；CPU 时间从进程启动算起
+  const auto main_start = std::chrono::steady_clock::now();
   CLI::App app{"随机字符串生成器 (使用系统调用的密码学安全随机数)"};
   app.set_version_flag("-v,--version", VERSION, "显示版本信息");
 
   size_t length = 16;
-  int count = 1;
-  int per_line = 1;
+  uint64_t count = 1;
+  uint64_t per_line = 1;
   int key_bits = 0; // 等效密钥长度（比特数），0 表示未指定
   std::string charset_literal;
   std::vector<std::string> charset_sources;
+  std::string weights_path;
+  std::string pattern_text;
+  bool unique = false;
+  std::string exclude_path;
+  std::string require_spec;
+  bool no_repeat = false;
+  bool exclude_ambiguous = false;
   bool show_charset = false;
+  size_t pool_size = SystemRandomGenerator::DEFAULT_POOL_SIZE;
+  bool show_stats = false;
+  std::string stats_format = "text";
+  std::string format_name = "text";
+  bool stream = false;
+  bool pipeline = false;
+  PipelineOptions pipeline_options;
+  PipelineStats pipeline_stats;
+  std::string output_path;
+  unsigned threads = 1;
+  std::string engine = "system";
+  uint64_t seed = 0;
+  bool mix_kernel = false;
+  uint64_t reseed_interval = ChaCha20Generator::DEFAULT_RESEED_INTERVAL;
+  std::string serve_socket;
+  std::string client_socket;
+  unsigned max_clients = ServerOptions{}.max_clients;
+  std::string jobs_path;
+  bool selftest = false;
 
   // 定义参数
   // 位置参数 1: 长度
-  app.add_option("length", length, "生成的字符串长度")->default_val(16);
+  auto *length_option =
+      app.add_option("length", length, "生成的字符串长度")->default_val(16);
 
   // 位置参数 2: 数量
-  app.add_option("count", count, "生成的字符串数量")->default_val(1);
+  auto *count_option =
+      app.add_option("count", count, "生成的字符串数量")->default_val(1);
 
   // 选项参数: -s/--set
-  app.add_option("-s,--set", charset_sources,
-                 "字符集来源 (dn, en, zh, sp,或文件路径)")
-      ->expected(1, -1); // 允许至少 1 个，最多不限
+  auto *set_option = app.add_option("-s,--set", charset_sources,
+                                    "字符集来源 (dn, en, zh, sp,或文件路径)")
+                         ->expected(1, -1); // 允许至少 1 个，最多不限
 
   // 选项参数: -c/--charset
-  app.add_option("-c,--charset", charset_literal,
-                 "直接提供字符集字符串（可与 -s 组合）");
+  auto *charset_option = app.add_option("-c,--charset", charset_literal,
+                                        "直接提供字符集字符串（可与 -s 组合）");
+
+  // 选项参数: --weights
+  app.add_option("--weights", weights_path,
+                 "带权字符集文件：每行“<字符> <权重>”，按权重比例抽取字符（别名表采样）")
+      ->excludes(set_option)
+      ->excludes(charset_option);
+
+  // 选项参数: --pattern
+  app.add_option("--pattern", pattern_text,
+                 "按模板生成，如 \"{en}{4}-{dn}{4}-[a-z]{4}\"：[...] 字符集合，"
+                 "{dn} 等内置字符集（{*} 为 -s/-c 指定的字符集），{n} 重复次数；"
+                 "此时唯一的位置参数为数量");
+
+  // 选项参数: --unique
+  app.add_flag("--unique", unique,
+               "保证输出的令牌互不相同（重复的令牌当场重新生成）");
+
+  // 选项参数: --exclude-file
+  app.add_option("--exclude-file", exclude_path,
+                 "配合 --unique：文件中的令牌（按空白分隔）不会再被输出，"
+                 "如之前已发放的令牌");
+
+  // 选项参数: --require
+  app.add_option("--require", require_spec,
+                 "口令策略：每个令牌至少包含的字符，如 \"dn:1,sp:2,[A-Z]:1\"（字符类"
+                 "写法同 --pattern）；先抽必需字符、再填满其余位置，最后无偏洗牌");
+
+  // 选项参数: --no-repeat
+  app.add_flag("--no-repeat", no_repeat, "同一令牌内不出现重复字符");
+
+  // 选项参数: --exclude-ambiguous
+  app.add_flag("--exclude-ambiguous", exclude_ambiguous,
+               "从字符集中去掉易混淆的字符 (0 O o 1 l I | ` ' \")");
 
   // 选项参数: --show-charset
   app.add_flag("--show-charset", show_charset, "输出最终字符集后再生成字符串");
@@ -242,80 +132,485 @@ int main(int argc, char *argv[]) {
   app.add_option("-n,--per-line", per_line, "每行输出的字符串数量")
       ->default_val(1);
 
+  // 选项参数: --format
+  app.add_option("--format", format_name,
+                 "输出格式: text (空格与换行分隔，默认)、nul (每个令牌后跟 "
+                 "\\0)、jsonl (每行一个 JSON 字符串)、csv (-n 为列数) 或 "
+                 "binary (4 字节小端长度前缀)")
+      ->check(CLI::IsMember({"text", "nul", "jsonl", "csv", "binary"}))
+      ->default_val("text");
+
   // 选项参数: -k/--key-bits
   app.add_option("-k,--key-bits", key_bits,
                  "等效密钥长度（比特数），根据字符集熵自动计算字符串长度")
       ->default_val(0);
 
+  // 选项参数: --pool-size
+  app.add_option("--pool-size", pool_size,
+                 "熵池大小（字节），一次系统调用填满；0 表示每次抽取都调用系统接口")
+      ->default_val(SystemRandomGenerator::DEFAULT_POOL_SIZE);
+
+  // 选项参数: --stream
+  app.add_flag("--stream", stream,
+               "流式输出：取消 10 MB 输出上限，内存占用与输出大小无关");
+
+  // 选项参数: --pipeline
+  app.add_flag("--pipeline", pipeline,
+               "流水线输出：生成线程填满预分配的缓冲区，经无锁环交给专门的写出"
+               "线程，生成与阻塞写出重叠（适合 gzip、ssh 等慢速下游）");
+
+  // 选项参数: --buffer-size
+  app.add_option("--buffer-size", pipeline_options.buffer_size,
+                 "流水线每个缓冲区的字节数")
+      ->default_val(PipelineOptions::DEFAULT_BUFFER_SIZE);
+
+  // 选项参数: --ring-depth
+  app.add_option("--ring-depth", pipeline_options.depth,
+                 "流水线环中的缓冲区个数（至少 2），0 表示取 4 与线程数 2 倍中"
+                 "的较大者")
+      ->default_val(0);
+
+  // 选项参数: --threads
+  app.add_option("--threads", threads,
+                 "生成线程数，0 表示使用全部 CPU 核心；输出顺序与单线程一致")
+      ->default_val(1);
+
+  // 选项参数: --engine
+  auto *engine_option =
+      app.add_option("--engine", engine,
+                     "随机数引擎: system (系统调用，默认)、chacha20 (用户态 "
+                     "CSPRNG，种子取自系统调用)、rdrand 或 rdseed (x86 硬件"
+                     "指令，不支持时回退到 getrandom)")
+          ->check(CLI::IsMember({"system", "chacha20", "rdrand", "rdseed"}))
+          ->default_val("system");
+
+  // 选项参数: --seed
+  auto *seed_option = app.add_option(
+      "--seed", seed,
+      "可复现模式：用该种子驱动非密码学引擎 xoshiro256**，同一种子与参数的输出"
+      "完全相同（与线程数无关；配合 --unique 时强制单线程），仅用于测试数据，"
+      "不得用于密码或密钥")
+      ->excludes(engine_option);
+
+  // 选项参数: --mix-kernel
+  app.add_flag("--mix-kernel", mix_kernel,
+               "rdrand / rdseed 引擎的输出再与内核熵 (getrandom) 异或，"
+               "不必只信任 CPU");
+
+  // 选项参数: --reseed-interval
+  app.add_option("--reseed-interval", reseed_interval,
+                 "chacha20 引擎每输出多少字节后重新播种；0 表示不定期重播种")
+      ->default_val(ChaCha20Generator::DEFAULT_RESEED_INTERVAL);
+
+  // 选项参数: -o, --output
+  app.add_option("-o,--output", output_path,
+                 "写入文件而不是标准输出：定宽字符集预分配并映射文件原地填充，"
+                 "其余字符集以大块 write 写出");
+
+  // 选项参数: --stats
+  app.add_flag("--stats", show_stats,
+               "生成结束后向标准错误输出统计信息（分阶段耗时、熵用量、吞吐量）");
+
+  // 选项参数: --stats-format
+  app.add_option("--stats-format", stats_format,
+                 "统计信息格式: text (默认) 或 json")
+      ->check(CLI::IsMember({"text", "json"}))
+      ->default_val("text");
+
+  // 选项参数: --serve
+  auto *serve_option = app.add_option(
+      "--serve", serve_socket,
+      "常驻服务模式：在该 Unix 域套接字上响应 \"<length> <count> [charset]\" "
+      "请求，-s/-c 指定的字符集作为 default");
+
+  // 选项参数: --client
+  app.add_option("--client", client_socket,
+                 "客户端模式：向该套接字上的服务请求 count 个字符串，-s "
+                 "的内置字符集名以 + 连接作为字符集 id")
+      ->excludes(serve_option);
+
+  // 选项参数: --jobs
+  app.add_option("--jobs", jobs_path,
+                 "批量任务清单：每行 \"<length> <count> <output> [source ...]\"，"
+                 "全部任务在一个进程内执行，字符集按来源缓存，--threads 为同时"
+                 "执行的任务数");
+
+  // 选项参数: --selftest
+  app.add_flag("--selftest", selftest,
+               "统计自检：各向量内核与标量实现逐字节比对，各引擎 × 采样路径做"
+               "卡方拟合、序列相关与参考路径对照检验，任一项失败即返回 1；此时"
+               "唯一的位置参数为每项检验的字符数");
+
+  // 选项参数: --max-clients
+  app.add_option("--max-clients", max_clients, "服务模式下同时服务的连接数上限")
+      ->default_val(ServerOptions{}.max_clients);
+
   CLI11_PARSE(app, argc, argv);
 
-  // 逻辑处理：构建最终的字符集字符串
-  std::string final_charset_str{};
-
-  if (charset_sources.empty() && charset_literal.empty()) {
-    final_charset_str = std::string(DEFAULT_CHARSET_nw);
-  } else {
-    if (!charset_literal.empty()) {
-      final_charset_str += charset_literal;
-    }
-
-    for (const auto &source : charset_sources) {
-      if (source == "dn") {
-        final_charset_str += std::string(digit_nw);
-      } else if (source == "en") {
-        final_charset_str += std::string(en_nw);
-      } else if (source == "zh") {
-        final_charset_str += std::string(zh);
-      } else if (source == "sp") {
-        final_charset_str += std::string(special);
+  // 未开启 --stats 时不读时钟、不计时
+  PhaseTimer phases(show_stats, main_start);
+  phases.mark("startup", "启动与参数解析");
+  CharsetBuildStats charset_stats;
+
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  if (selftest) {
+    // 自检只接受字符数与 --threads，其余选项都不参与
+    if (length_option->count() > 0 && count_option->count() > 0) {
+      std::cerr << "错误: --selftest 模式下只需给出每项检验的字符数。\n";
+      return 1;
+    }
+    if (set_option->count() > 0 || charset_option->count() > 0 ||
+        !weights_path.empty() || !pattern_text.empty() || unique ||
+        !require_spec.empty() || no_repeat || exclude_ambiguous ||
+        key_bits > 0 || !output_path.empty() || stream || pipeline ||
+        show_charset || show_stats || seed_option->count() > 0 ||
+        engine_option->count() > 0 || mix_kernel || !serve_socket.empty() ||
+        !client_socket.empty() || !jobs_path.empty()) {
+      std::cerr << "错误: --selftest 只能与 --threads 同时使用。\n";
+      return 1;
+    }
+    SelftestOptions selftest_options;
+    selftest_options.threads = threads;
+    if (length_option->count() > 0) {
+      selftest_options.symbols = length;
+    } else if (count_option->count() > 0) {
+      selftest_options.symbols = count;
+    }
+    if (selftest_options.symbols < SelftestOptions::MIN_SYMBOLS) {
+      std::cerr << "错误: 每项检验的字符数至少为 "
+                << SelftestOptions::MIN_SYMBOLS << "。\n";
+      return 1;
+    }
+    uint64_t passed = 0;
+    uint64_t skipped = 0;
+    uint64_t failed =
+        run_selftest(selftest_options, [&](const SelftestResult &result) {
+          passed += result.passed ? 1 : 0;
+          skipped += result.skipped ? 1 : 0;
+          std::cout << (result.skipped  ? "跳过"
+                        : result.passed ? "通过"
+                                        : "失败")
+                    << "  " << result.name << "  " << result.detail
+                    << std::endl;
+        });
+    if (failed > 0) {
+      std::cerr << "错误: 自检失败 " << failed << " 项（通过 " << passed
+                << " 项，跳过 " << skipped << " 项）。\n";
+      return 1;
+    }
+    std::cout << "自检通过：" << passed << " 项通过，" << skipped
+              << " 项跳过。\n";
+    return 0;
+  }
+
+  const OutputFormat format = parse_output_format(format_name);
+  const OutputLayout layout = output_layout(format);
+
+  if (per_line == 0) {
+    std::cerr << "错误: 每行输出的字符串数量必须大于 0。\n";
+    return 1;
+  }
+
+  if (!pattern_text.empty()) {
+    // 模板决定令牌长度：只给一个位置参数时视为数量
+    if (length_option->count() > 0 && count_option->count() > 0) {
+      std::cerr << "错误: --pattern 模式下令牌长度由模板决定，只需给出数量。\n";
+      return 1;
+    }
+    if (length_option->count() > 0) {
+      count = length;
+    }
+    if (key_bits > 0 || !client_socket.empty() || !serve_socket.empty()) {
+      std::cerr << "错误: --pattern 不能与 -k、--serve、--client 同时使用。\n";
+      return 1;
+    }
+  }
+
+  const bool policy_mode = !require_spec.empty() || no_repeat;
+  if (policy_mode &&
+      (!pattern_text.empty() || !weights_path.empty() ||
+       !client_socket.empty() || !serve_socket.empty())) {
+    std::cerr << "错误: --require、--no-repeat 不能与 --pattern、--weights、"
+                 "--serve、--client 同时使用。\n";
+    return 1;
+  }
+  if (exclude_ambiguous && (!weights_path.empty() || !client_socket.empty())) {
+    std::cerr << "错误: --exclude-ambiguous 不能与 --weights、--client 同时使用。\n";
+    return 1;
+  }
+
+  const bool seeded = seed_option->count() > 0;
+  if (seeded) {
+    if (!client_socket.empty() || !serve_socket.empty()) {
+      std::cerr << "错误: --seed 不能与 --serve、--client 同时使用。\n";
+      return 1;
+    }
+    engine = "xoshiro256**";
+    std::cerr << "警告: --seed 使用非密码学随机数引擎 xoshiro256**，输出可预测，"
+                 "只能用作测试数据，不得用于密码、密钥或令牌。\n";
+    // 多线程去重时重复令牌被哪个线程丢弃取决于时序，输出不再可复现
+    if (unique && threads > 1) {
+      std::cerr << "警告: --seed 与 --unique 同时使用时只能单线程生成，"
+                   "已忽略 --threads。\n";
+      threads = 1;
+    }
+  }
+
+  const bool hardware_engine = engine == "rdrand" || engine == "rdseed";
+  if (mix_kernel && !hardware_engine) {
+    std::cerr << "错误: --mix-kernel 只适用于 rdrand、rdseed 引擎。\n";
+    return 1;
+  }
+  const HardwareInstruction instruction = engine == "rdseed"
+                                              ? HardwareInstruction::rdseed
+                                              : HardwareInstruction::rdrand;
+  if (hardware_engine && client_socket.empty()) {
+    if (const char *reason = hardware_random_unavailable(instruction)) {
+      std::cerr << "警告: " << engine << " 不可用（" << reason
+                << "），回退到 getrandom。\n";
+    }
+  }
+
+  if (!jobs_path.empty()) {
+    // 批量任务：长度、数量、字符集与输出目标都由清单逐行给出
+    if (length_option->count() > 0 || count_option->count() > 0 ||
+        set_option->count() > 0 || charset_option->count() > 0 ||
+        !weights_path.empty() || !pattern_text.empty() || unique ||
+        policy_mode || exclude_ambiguous || key_bits > 0 ||
+        !output_path.empty() || pipeline || show_charset ||
+        !serve_socket.empty() || !client_socket.empty()) {
+      std::cerr << "错误: --jobs 只能与 --threads、--engine、--seed、"
+                   "--mix-kernel、--pool-size、--reseed-interval、--format、"
+                   "-n、--stream、--stats 同时使用。\n";
+      return 1;
+    }
+    std::vector<JobSpec> jobs;
+    try {
+      jobs = load_job_manifest(jobs_path);
+    } catch (const std::runtime_error &e) {
+      std::cerr << "错误: " << e.what() << "\n";
+      return 1;
+    }
+    JobOptions job_options;
+    job_options.engine = engine == "chacha20" ? EngineKind::chacha20
+                         : engine == "rdrand" ? EngineKind::rdrand
+                         : engine == "rdseed" ? EngineKind::rdseed
+                                              : EngineKind::system;
+    job_options.seeded = seeded;
+    job_options.seed = seed;
+    job_options.mix_kernel = mix_kernel;
+    job_options.pool_size = pool_size;
+    job_options.reseed_interval = reseed_interval;
+    job_options.format = format;
+    job_options.per_line = per_line;
+    job_options.threads = threads;
+    job_options.max_output_bytes = stream ? 0 : MAX_OUTPUT_SIZE;
+    phases.mark("manifest", "读取任务清单");
+
+    std::vector<JobResult> results;
+    JobRunStats job_stats = run_jobs(jobs, job_options, results);
+    phases.mark("jobs", "执行任务");
+
+    for (const auto &warning : job_stats.warnings) {
+      std::cerr << "警告: " << warning << " (跳过)\n";
+    }
+    uint64_t failed = 0;
+    uint64_t output_bytes = 0;
+    uint64_t tokens = 0;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+      if (!results[i].error.empty()) {
+        ++failed;
+        std::cerr << "错误: 任务清单第 " << jobs[i].line << " 行 ("
+                  << jobs[i].output << "): " << results[i].error << "\n";
       } else {
-        try {
-          final_charset_str += load_charset_from_file(source);
-        } catch (const std::exception &e) {
-          std::cerr << "警告: " << e.what() << " (跳过)\n";
-        }
+        output_bytes += results[i].output_bytes;
+        tokens += jobs[i].count;
       }
     }
-  }
 
-  // 统一清理空白字符
-  final_charset_str.erase(
-      std::remove_if(final_charset_str.begin(), final_charset_str.end(),
-                     [](unsigned char c) { return std::isspace(c); }),
-      final_charset_str.end());
+    if (show_stats) {
+      StatsReport report;
+      report.add("engine", "引擎", engine);
+      report.add("jobs", "任务数", uint64_t{jobs.size()});
+      report.add("jobs_failed", "失败任务数", failed);
+      report.add("jobs_files_loaded", "读取字符集文件数", job_stats.files_loaded);
+      report.add("jobs_charsets_built", "构建字符集数", job_stats.charsets_built);
+      report.add("jobs_charset_cache_hits", "字符集缓存命中数",
+                 job_stats.charset_cache_hits);
+      report.add("jobs_steals", "窃取任务数", job_stats.steals);
+      report.add("threads", "线程数", uint64_t{threads});
+      report.add("output_bytes", "输出字节数", output_bytes);
+      double seconds = phases.phases().back().wall_seconds;
+      report.add("generation_seconds", "生成耗时", seconds, "秒");
+      if (seconds > 0) {
+        report.add("tokens_per_second", "吞吐量 (个/秒)", tokens / seconds);
+        report.add("mb_per_second", "吞吐量 (MB/秒)",
+                   output_bytes / 1024.0 / 1024.0 / seconds);
+      }
+      if (stats_format == "json") {
+        report.print_json(std::cerr, phases.phases());
+      } else {
+        report.print_text(std::cerr, phases.phases());
+      }
+    }
+    return failed > 0 ? 1 : 0;
+  }
 
-  // 预处理：将字符集解析为字符向量
-  std::vector<std::string> charset_vec = split_utf8_string(final_charset_str);
+  if (!exclude_path.empty() && !unique) {
+    std::cerr << "错误: --exclude-file 需要与 --unique 一起使用。\n";
+    return 1;
+  }
+  if (unique && (!client_socket.empty() || !serve_socket.empty())) {
+    std::cerr << "错误: --unique 不能与 --serve、--client 同时使用。\n";
+    return 1;
+  }
 
-  // 去重逻辑：排序并移除重复字符
-  std::sort(charset_vec.begin(), charset_vec.end());
-  charset_vec.erase(std::unique(charset_vec.begin(), charset_vec.end()),
-                    charset_vec.end());
+  if (!client_socket.empty()) {
+    // 客户端模式：字符集由服务端常驻，本地只拼出字符集 id
+    if (!charset_literal.empty() || !weights_path.empty()) {
+      std::cerr << "错误: 客户端模式不支持 -c 与 --weights，请使用 -s 指定内置字符集。\n";
+      return 1;
+    }
+    std::string charset_id = "default";
+    for (size_t i = 0; i < charset_sources.size(); ++i) {
+      charset_id = (i == 0 ? "" : charset_id + "+") + charset_sources[i];
+    }
+#ifndef _WIN32
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+    int out_fd = STDOUT_FILENO;
+    try {
+      if (!output_path.empty()) {
+        out_fd = open_output_file(output_path);
+      }
+      OutputWriter out(out_fd);
+      request_tokens(client_socket, length, count, charset_id, out);
+    } catch (const OutputClosed &) {
+      // 下游已不再读取，静默结束
+    } catch (const std::runtime_error &e) {
+      std::cerr << "错误: " << e.what() << "\n";
+      return 1;
+    }
+    if (out_fd != STDOUT_FILENO) {
+      close_output_file(out_fd);
+    }
+    return 0;
+  }
 
-  if (charset_vec.empty()) {
-    std::cerr << "错误: 有效字符集为空。\n";
+  // 逻辑处理：按来源构建去重后的紧凑字符集
+  std::vector<std::string> charset_warnings;
+  std::string charset_error;
+  Charset charset;
+  try {
+    if (!weights_path.empty()) {
+      charset = load_weighted_charset(weights_path);
+    } else {
+      charset = build_charset(charset_literal, charset_sources,
+                              &charset_warnings,
+                              show_stats ? &charset_stats : nullptr);
+    }
+    if (exclude_ambiguous) {
+      charset = exclude_chars(charset, AMBIGUOUS_CHARS);
+    }
+  } catch (const std::runtime_error &e) {
+    charset_error = e.what();
+  }
+  for (const auto &warning : charset_warnings) {
+    std::cerr << "警告: " << warning << " (跳过)\n";
+  }
+  if (!charset_error.empty()) {
+    std::cerr << "错误: " << charset_error << "\n";
     return 1;
   }
 
+  std::optional<TokenPattern> pattern;
+  if (!pattern_text.empty()) {
+    try {
+      pattern = TokenPattern::compile(pattern_text, charset);
+    } catch (const std::invalid_argument &e) {
+      std::cerr << "错误: 无效的模板: " << e.what() << "\n";
+      return 1;
+    }
+  }
+
+  std::optional<TokenPolicy> policy;
+  if (policy_mode) {
+    try {
+      policy = TokenPolicy::compile(require_spec, charset, no_repeat);
+    } catch (const std::invalid_argument &e) {
+      std::cerr << "错误: 无效的策略: " << e.what() << "\n";
+      return 1;
+    }
+  }
+
+  phases.mark("charset", "构建字符集");
+
   if (show_charset) {
-    std::cerr << "字符集(" << charset_vec.size() << "): ";
-    for (const auto &ch : charset_vec) {
-      std::cerr << ch;
+    std::cerr << "字符集(" << charset.size() << "): " << charset.joined()
+              << "\n";
+    if (pattern) {
+      std::cerr << "模板: " << pattern->describe() << "\n";
+    }
+    if (policy) {
+      std::cerr << "策略: " << policy->describe() << "\n";
     }
-    std::cerr << "\n";
+  }
+
+  if (!serve_socket.empty()) {
+    ServerOptions options;
+    options.socket_path = serve_socket;
+    options.engine = engine == "chacha20" ? EngineKind::chacha20
+                     : engine == "rdrand"   ? EngineKind::rdrand
+                     : engine == "rdseed"   ? EngineKind::rdseed
+                                            : EngineKind::system;
+    options.mix_kernel = mix_kernel;
+    options.pool_size = pool_size;
+    options.reseed_interval = reseed_interval;
+    options.max_clients = std::max(1u, max_clients);
+    options.max_response_bytes = MAX_OUTPUT_SIZE;
+    std::cerr << "令牌服务已启动: " << serve_socket << "\n";
+    try {
+      run_token_server(options, std::move(charset));
+    } catch (const std::runtime_error &e) {
+      std::cerr << "错误: " << e.what() << "\n";
+      return 1;
+    }
+    return 0;
   }
 
   // 如果指定了等效密钥长度，根据字符集熵计算所需字符串长度
-  if (key_bits > 0) {
-    // 计算字符集的熵（每个字符提供的比特数）
-    double entropy_per_char =
-        std::log2(static_cast<double>(charset_vec.size()));
+  if (policy) {
+    // 策略模式：熵按各次抽取的可选字符数保守估计（见 TokenPolicy::bits）
+    try {
+      if (key_bits > 0) {
+        length = policy->length_for_bits(key_bits);
+      } else {
+        policy->check(length);
+      }
+    } catch (const std::invalid_argument &e) {
+      std::cerr << "错误: " << e.what() << "\n";
+      return 1;
+    }
+    if (key_bits > 0) {
+      std::cerr << "字符集大小: " << charset.size() << " 个字符\n";
+      std::cerr << "策略必需字符: " << policy->required() << " 个\n";
+      std::cerr << "目标密钥强度: " << key_bits << " 比特\n";
+      std::cerr << "计算得到的字符串长度: " << length << " 个字符\n";
+      std::cerr << "实际密钥强度 (下限): " << policy->bits(length) << " 比特\n";
+      std::cerr << "---\n";
+    }
+  } else if (key_bits > 0) {
+    // 计算字符集的熵（每个字符提供的比特数；带权字符集按最小熵估计）
+    double entropy_per_char = charset.bits_per_char();
 
     // 计算需要的字符数以达到指定的密钥强度
     length = static_cast<size_t>(std::ceil(key_bits / entropy_per_char));
 
     // 输出信息
-    std::cerr << "字符集大小: " << charset_vec.size() << " 个字符\n";
+    std::cerr << "字符集大小: " << charset.size() << " 个字符\n";
     std::cerr << "每字符熵: " << entropy_per_char << " 比特\n";
     std::cerr << "目标密钥强度: " << key_bits << " 比特\n";
     std::cerr << "计算得到的字符串长度: " << length << " 个字符\n";
@@ -323,80 +618,338 @@ int main(int argc, char *argv[]) {
     std::cerr << "---\n";
   }
 
-  // 初始化系统调用的密码学安全随机数生成器
-  SystemRandomGenerator generator;
-
-  // 估算总输出大小
-  // 计算字符集中每个字符的平均字节数
-  size_t total_charset_bytes = 0;
-  for (const auto &ch : charset_vec) {
-    total_charset_bytes += ch.size();
+  // --unique：去重表按数量预先分配，排除列表中的令牌先行插入
+  std::optional<TokenKeyEncoder> unique_encoder;
+  std::unique_ptr<UniqueTable> unique_table;
+  uint64_t unique_excluded = 0;
+  uint64_t unique_excluded_skipped = 0;
+  uint64_t unique_duplicates_before = 0;
+  if (unique) {
+    if (pattern) {
+      unique_encoder.emplace(pattern->max_bytes());
+    } else {
+      unique_encoder.emplace(charset, length);
+    }
+    unique_table = std::make_unique<UniqueTable>(
+        unique_encoder->key_bytes(), count, threads > 1 ? threads * 16 : 1);
+    if (!exclude_path.empty()) {
+      std::vector<unsigned char> key(unique_encoder->key_bytes());
+      try {
+        for_each_token_in_file(exclude_path, [&](std::string_view token) {
+          if (!unique_encoder->encode(token, key.data())) {
+            ++unique_excluded_skipped; // 不可能被生成，无需排除
+          } else if (unique_table->insert(key.data())) {
+            ++unique_excluded;
+          }
+        });
+      } catch (const std::runtime_error &e) {
+        std::cerr << "错误: " << e.what() << "\n";
+        return 1;
+      }
+      secure_wipe(key.data(), key.size());
+      unique_duplicates_before = unique_table->duplicates();
+    }
+    // 策略模式按熵下限估计：可能的令牌至少有 2^bits 种
+    double space_bits =
+        pattern  ? pattern->space_bits()
+        : policy ? policy->bits(length)
+                 : length * std::log2(static_cast<double>(charset.size()));
+    double needed = static_cast<double>(count) +
+                    static_cast<double>(unique_excluded);
+    if (std::log2(std::max(needed, 1.0)) > space_bits + 1e-9) {
+      std::cerr << "错误: 要求 " << count << " 个互不相同的令牌";
+      if (unique_excluded > 0) {
+        std::cerr << "（另排除 " << unique_excluded << " 个）";
+      }
+      if (space_bits < 53) {
+        std::cerr << "，但只有 "
+                  << static_cast<uint64_t>(std::llround(std::exp2(space_bits)))
+                  << " 种可能。\n";
+      } else {
+        std::cerr << "，但只有约 2^" << space_bits << " 种可能。\n";
+      }
+      return 1;
+    }
   }
-  double avg_bytes_per_char =
-      static_cast<double>(total_charset_bytes) / charset_vec.size();
 
-  // 估算每个随机字符串的字节数
-  size_t estimated_string_bytes =
-      static_cast<size_t>(length * avg_bytes_per_char);
+  // 估算总输出大小（模板按最大长度估算）
+  double estimated_total_size = estimate_output_bytes(
+      pattern ? static_cast<double>(pattern->max_bytes())
+              : average_token_bytes(charset, length),
+      count, format);
 
-  // 估算分隔符的字节数（空格或换行）
-  size_t separator_bytes = count - 1;    // count-1 个分隔符（空格）
-  separator_bytes += (count / per_line); // 换行符数量
-
-  // 估算总输出大小
-  size_t estimated_total_size =
-      estimated_string_bytes * count + separator_bytes;
-
-  // 检查是否超过 10 MB 限制
-  if (estimated_total_size > MAX_OUTPUT_SIZE) {
-    std::cerr << "错误: 估算输出大小 (" << estimated_total_size << " 字节, 约 "
+  // 非流式模式下检查是否超过 10 MB 限制
+  if (!stream && estimated_total_size > MAX_OUTPUT_SIZE) {
+    std::cerr << "错误: 估算输出大小 ("
+              << static_cast<uint64_t>(estimated_total_size) << " 字节, 约 "
               << (estimated_total_size / 1024.0 / 1024.0)
               << " MB) 超过 10 MB 限制。\n";
-    std::cerr << "请减少字符串长度或数量。\n";
+    std::cerr << "请减少字符串长度或数量，或使用 --stream 流式输出。\n";
     return 1;
   }
 
-  // 输出生成的字符串
-  // 如果估算大小小于等于 1 KB，直接输出
-  if (estimated_total_size <= CHUNK_SIZE) {
-    for (int i = 0; i < count; ++i) {
-      if (i > 0 && i % per_line == 0) {
-        std::cout << "\n";
-      } else if (i > 0) {
-        std::cout << " ";
+#ifndef _WIN32
+  // 忽略 SIGPIPE，让下游提前关闭管道时 write 返回 EPIPE 而不是直接杀死进程
+  std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+  // 初始化随机数引擎并输出生成的字符串
+  std::cout.flush();
+  int out_fd = STDOUT_FILENO;
+  if (!output_path.empty()) {
+    try {
+      out_fd = open_output_file(output_path);
+    } catch (const std::runtime_error &e) {
+      std::cerr << "错误: " << e.what() << "\n";
+      return 1;
+    }
+  }
+  // 写文件且字符集定宽时输出大小已知，映射文件原地填充；否则经 OutputWriter
+  uint64_t mapped_bytes = 0;
+  if (out_fd != STDOUT_FILENO && MappedOutput::supported(out_fd)) {
+    if (pattern) {
+      mapped_bytes =
+          mapped_output_bytes(FramedTokens(*pattern, format), count, layout);
+    } else if (policy) {
+      mapped_bytes = mapped_output_bytes(
+          FramedTokens(PolicyTokens(*policy, length), format), count, layout);
+    } else {
+      mapped_bytes = mapped_output_bytes(
+          FramedTokens(CharsetTokens(charset, length), format), count, layout);
+    }
+  }
+  // 映射输出不经过 OutputWriter，不必分配大缓冲区
+  size_t buffer_size = OutputWriter::DEFAULT_BUFFER_SIZE;
+  if (mapped_bytes > 0 || pipeline) {
+    buffer_size = 1;
+  } else if (out_fd != STDOUT_FILENO) {
+    buffer_size = FILE_BUFFER_SIZE;
+  }
+  OutputWriter out(out_fd, buffer_size);
+  if (show_stats) {
+    SystemRandomGenerator::enable_timing();
+    out.enable_timing();
+  }
+  phases.mark("prepare", "准备输出");
+  auto generate = [&](auto make_generator, const auto &source) {
+    if (mapped_bytes > 0) {
+      MappedOutput mapped(out_fd, mapped_bytes);
+      output_random_strings_mapped(make_generator, source, count, per_line,
+                                   threads, mapped.data(), layout);
+    } else if (pipeline) {
+      pipeline_stats = output_random_strings_pipelined(
+          make_generator, source, count, per_line, threads, out,
+          pipeline_options, layout);
+    } else {
+      run_generation(make_generator, source, count, per_line, threads, out,
+                     layout);
+    }
+  };
+  auto generate_with_engine = [&](const auto &source) {
+    if (seeded) {
+      generate([&] { return Xoshiro256Generator(seed); }, source);
+    } else if (engine == "chacha20") {
+      generate([&] { return ChaCha20Generator(reseed_interval); }, source);
+    } else if (hardware_engine) {
+      generate(
+          [&] {
+            return HardwareRandomGenerator(instruction, mix_kernel, pool_size);
+          },
+          source);
+    } else {
+      generate([&] { return SystemRandomGenerator(pool_size); }, source);
+    }
+  };
+  // text 格式不加框，生成路径与以前完全相同
+  auto generate_framed = [&](const auto &source) {
+    if (format == OutputFormat::text) {
+      generate_with_engine(source);
+    } else {
+      generate_with_engine(FramedTokens(source, format));
+    }
+  };
+  auto generate_tokens = [&](const auto &source) {
+    if (unique_table) {
+      generate_framed(UniqueTokens(source, *unique_encoder, *unique_table));
+    } else {
+      generate_framed(source);
+    }
+  };
+  try {
+    if (pattern) {
+      generate_tokens(*pattern);
+    } else if (policy) {
+      generate_tokens(PolicyTokens(*policy, length));
+    } else {
+      generate_tokens(CharsetTokens(charset, length));
+    }
+  } catch (const OutputClosed &) {
+    // 下游已不再读取（例如 | head），静默结束
+  } catch (const std::runtime_error &e) {
+    std::cerr << "错误: " << e.what() << "\n";
+    return 1;
+  }
+  if (out_fd != STDOUT_FILENO) {
+    close_output_file(out_fd);
+  }
+  phases.mark("generate", "生成与写出");
+
+  if (show_stats) {
+    StatsReport report;
+    report.add("charset_size", "字符集大小", uint64_t{charset.size()}, "个字符");
+    report.add("charset_load_seconds", "读取字符集文件 (映射、UTF-8 校验与去重)",
+               charset_stats.load_seconds, "秒");
+    report.add("charset_loaded_bytes", "读取字符集文件字节数",
+               charset_stats.loaded_bytes);
+    report.add("charset_loaded_chars", "字符集文件字符数 (去重前)",
+               charset_stats.loaded_chars);
+    report.add("charset_loaded_unique", "字符集文件字符数 (去重后)",
+               charset_stats.loaded_unique);
+    report.add("utf8_validator", "UTF-8 校验内核",
+               std::string(utf8_validator().name));
+    report.add("charset_merge_seconds", "切分与去重", charset_stats.merge_seconds,
+               "秒");
+
+    report.add("engine", "引擎", engine);
+    if (engine == "chacha20") {
+      report.add("chacha20_kernel", "ChaCha20 内核",
+                 std::string(ChaCha20Generator::kernel_name()));
+      report.add("reseeds", "播种次数", ChaCha20Generator::reseed_count());
+    } else if (seeded) {
+      report.add("seed", "种子", seed);
+    } else if (hardware_engine) {
+      const char *reason = hardware_random_unavailable(instruction);
+      report.add("hardware_instruction", "硬件指令",
+                 std::string(reason ? "不可用，已回退到 getrandom" : "可用"));
+      report.add("hardware_retries", "指令重试次数",
+                 HardwareRandomGenerator::retry_count());
+      report.add("mix_kernel", "与内核熵混合",
+                 std::string(mix_kernel ? "是" : "否"));
+      if (reason || mix_kernel) {
+        report.add("pool_size", "熵池大小", uint64_t{pool_size}, "字节");
       }
-      std::cout << generate_random_string(length, charset_vec, generator);
-    }
-    std::cout << "\n";
-  } else {
-    // 大于 1 KB，使用分块输出
-    std::string buffer;
-    buffer.reserve(CHUNK_SIZE * 2); // 预留缓冲区
-
-    for (int i = 0; i < count; ++i) {
-      // 添加分隔符
-      if (i > 0 && i % per_line == 0) {
-        buffer += "\n";
-      } else if (i > 0) {
-        buffer += " ";
+    } else {
+      report.add("pool_size", "熵池大小", uint64_t{pool_size}, "字节");
+    }
+    uint64_t syscalls = SystemRandomGenerator::syscall_count();
+    report.add("entropy_syscalls", "熵系统调用次数 (getrandom/read)", syscalls);
+    report.add("entropy_syscall_seconds", "熵系统调用耗时 (各线程累计)",
+               SystemRandomGenerator::syscall_seconds(), "秒");
+    report.add("entropy_bytes_fetched", "获取熵字节数",
+               SystemRandomGenerator::entropy_bytes());
+    const uint64_t entropy_consumed = CharsetSampler::total_entropy_bytes() +
+                                      PolicyTokens::total_entropy_bytes();
+    report.add("entropy_bytes_consumed", "采样消耗熵字节数", entropy_consumed);
+
+    uint64_t total_chars = count * (pattern ? pattern->sampled_chars() : length);
+    if (pattern) {
+      report.add("pattern_segments", "模板段数",
+                 uint64_t{pattern->segment_count()});
+      report.add("pattern_bits", "每个令牌的熵", pattern->bits(), "比特");
+    }
+    if (policy) {
+      report.add("policy_required", "策略必需字符数",
+                 uint64_t{policy->required()}, "个");
+      report.add("policy_bits", "每个令牌的熵 (下限)", policy->bits(length),
+                 "比特");
+    }
+    if (total_chars > 0 && pattern) {
+      report.add("rejections", "采样拒绝次数",
+                 CharsetSampler::total_rejections());
+      report.add("entropy_bytes_per_char", "每字符消耗熵",
+                 CharsetSampler::total_entropy_bytes() * 1.0 / total_chars,
+                 "字节");
+      report.add("entropy_bytes_per_char_min", "每字符熵理论下限",
+                 pattern->bits() / pattern->sampled_chars() / 8, "字节");
+    } else if (total_chars > 0 && policy) {
+      // 策略模式直接用索引采样器并洗牌，计数在 PolicyTokens 中
+      report.add("rejections", "采样拒绝次数", PolicyTokens::total_rejections());
+      report.add("entropy_bytes_per_char", "每字符消耗熵",
+                 entropy_consumed * 1.0 / total_chars, "字节");
+      report.add("entropy_bytes_per_char_min", "每字符熵下限 (策略)",
+                 policy->bits(length) / length / 8, "字节");
+    } else if (total_chars > 0) {
+      CharsetSampler sampler(charset);
+      report.add("sampling_path", "采样路径", std::string(sampler.path_name()));
+      if (sampler.path() == SamplingPath::pow2) {
+        report.add("bits_per_char", "每字符随机位数 (无拒绝)",
+                   uint64_t{sampler.pow2_bits()});
+      } else {
+        report.add("lemire_batch", "Lemire 批次 (每个 64 位随机字的索引数)",
+                   uint64_t{IndexSampler(charset.size()).batch()});
       }
+      report.add("rejections", "采样拒绝次数",
+                 CharsetSampler::total_rejections());
+      report.add("entropy_bytes_per_char", "每字符消耗熵",
+                 CharsetSampler::total_entropy_bytes() * 1.0 / total_chars,
+                 "字节");
+      report.add("entropy_bytes_per_char_min", "每字符熵理论下限",
+                 charset.bits_per_char() / 8, "字节");
+    }
 
-      // 生成并添加随机字符串
-      buffer += generate_random_string(length, charset_vec, generator);
-
-      // 如果缓冲区大于 1 KB，输出并清空
-      if (buffer.size() >= CHUNK_SIZE) {
-        std::cout << buffer;
-        std::cout.flush(); // 立即刷新输出
-        buffer.clear();
+    uint64_t output_bytes = mapped_bytes > 0 ? mapped_bytes : out.bytes_written();
+    double output_mb = output_bytes / 1024.0 / 1024.0;
+    if (unique_table) {
+      uint64_t stored = unique_table->size();
+      uint64_t table_bytes = unique_table->memory_bytes();
+      report.add("unique_excluded", "排除列表令牌数", unique_excluded);
+      report.add("unique_excluded_skipped", "排除列表中不可能生成的令牌数",
+                 unique_excluded_skipped);
+      report.add("unique_regenerated", "重复后重新生成次数",
+                 unique_table->duplicates() - unique_duplicates_before);
+      report.add("unique_key_bytes", "去重键长度",
+                 uint64_t{unique_table->key_bytes()}, "字节");
+      report.add("unique_table_bytes", "去重表内存", table_bytes, "字节");
+      if (stored > 0) {
+        report.add("unique_bytes_per_token", "去重表每令牌内存",
+                   static_cast<double>(table_bytes) / stored, "字节");
       }
     }
+    report.add("output_format", "输出格式", format_name);
+    bool pipelined = pipeline && mapped_bytes == 0;
+    report.add("output_mode", "输出方式",
+               std::string(mapped_bytes > 0 ? "mmap"
+                            : pipelined     ? "pipeline"
+                                            : "write"));
+    if (pipelined) {
+      report.add("pipeline_buffer_bytes", "流水线缓冲区大小",
+                 uint64_t{pipeline_stats.buffer_bytes}, "字节");
+      report.add("pipeline_ring_depth", "流水线环深度",
+                 uint64_t{pipeline_stats.depth}, "个缓冲区");
+      report.add("pipeline_buffers", "写出的缓冲区个数", pipeline_stats.buffers);
+      report.add("pipeline_producer_stalls", "生成线程等待次数 (输出端慢)",
+                 pipeline_stats.producer_stalls);
+      report.add("pipeline_producer_stall_seconds",
+                 "生成线程等待耗时 (各线程累计)",
+                 pipeline_stats.producer_stall_seconds, "秒");
+      report.add("pipeline_writer_stalls", "写出线程等待次数 (生成慢)",
+                 pipeline_stats.writer_stalls);
+      report.add("pipeline_writer_stall_seconds", "写出线程等待耗时",
+                 pipeline_stats.writer_stall_seconds, "秒");
+    }
+    report.add("output_bytes", "输出字节数", output_bytes);
+    report.add("write_calls", "write 调用次数", out.write_calls());
+    report.add("write_seconds", "write 耗时", out.write_seconds(), "秒");
+    if (output_bytes > 0) {
+      report.add("syscalls_per_mb", "每 MB 输出熵系统调用次数",
+                 syscalls / output_mb);
+    }
+
+    double generation_seconds = phases.phases().back().wall_seconds;
+    report.add("threads", "线程数", uint64_t{threads});
+    report.add("generation_seconds", "生成耗时", generation_seconds, "秒");
+    if (generation_seconds > 0) {
+      report.add("tokens_per_second", "吞吐量 (个/秒)",
+                 count / generation_seconds);
+      report.add("mb_per_second", "吞吐量 (MB/秒)",
+                 output_mb / generation_seconds);
+    }
 
-    // 输出剩余内容
-    if (!buffer.empty()) {
-      std::cout << buffer;
+    if (stats_format == "json") {
+      report.print_json(std::cerr, phases.phases());
+    } else {
+      report.print_text(std::cerr, phases.phases());
     }
-    std::cout << "\n";
   }
 
   return 0;
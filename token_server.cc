@@ -0,0 +1,449 @@
+// 常驻令牌服务与客户端（仅支持提供 Unix 域套接字的平台）
+#include "token_server.hpp"
+
+#include <cerrno>
+#include <charconv>
+#include <list>
+#include <map>
+#include <set>
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace randomstr {
+
+#ifdef _WIN32
+
+void run_token_server(const ServerOptions &, Charset) {
+  throw std::runtime_error("当前平台不支持 --serve（需要 Unix 域套接字）");
+}
+
+void request_tokens(const std::string &, size_t, uint64_t, const std::string &,
+                    OutputWriter &) {
+  throw std::runtime_error("当前平台不支持 --client（需要 Unix 域套接字）");
+}
+
+#else
+
+namespace {
+
+constexpr size_t MAX_REQUEST_LINE = 256;
+constexpr size_t RESPONSE_BUFFER_SIZE = 16 * 1024;
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+void request_stop(int) { stop_requested = 1; }
+
+sockaddr_un make_address(const std::string &path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+    throw std::runtime_error("套接字路径为空或过长: " + path);
+  }
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  return address;
+}
+
+// 服务端常驻的字符集：首次请求时构建，之后只读共享，永不释放
+class CharsetRegistry {
+public:
+  explicit CharsetRegistry(Charset default_charset) {
+    charsets_.emplace("default",
+                      std::make_unique<Charset>(std::move(default_charset)));
+  }
+
+  // 未知或非法的字符集名返回 nullptr。组合先排序去重再作为键，缓存最多只有
+  // 内置字符集的 15 种组合加 default，客户端无法让它无限增长
+  const Charset *find(const std::string &id) {
+    if (id == "default") {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return charsets_.at(id).get();
+    }
+    // 只接受内置字符集的组合，客户端不能让服务端读取任意文件
+    std::set<std::string> names;
+    size_t begin = 0;
+    while (begin <= id.size()) {
+      size_t end = std::min(id.find('+', begin), id.size());
+      std::string name = id.substr(begin, end - begin);
+      if (name != "dn" && name != "en" && name != "zh" && name != "sp") {
+        return nullptr;
+      }
+      names.insert(std::move(name));
+      begin = end + 1;
+    }
+    std::string key;
+    for (const auto &name : names) {
+      key += (key.empty() ? "" : "+") + name;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = charsets_.find(key);
+    if (it != charsets_.end()) {
+      return it->second.get();
+    }
+    auto charset = std::make_unique<Charset>(build_charset(
+        "", std::vector<std::string>(names.begin(), names.end())));
+    return charsets_.emplace(key, std::move(charset)).first->second.get();
+  }
+
+private:
+  std::mutex mutex_;
+  std::map<std::string, std::unique_ptr<Charset>> charsets_;
+};
+
+// 单个连接：独立的引擎、按字符集缓存的采样器和复用的应答缓冲
+template <typename Generator> class Connection {
+public:
+  Connection(int fd, Generator generator, CharsetRegistry &registry,
+             const ServerOptions &options)
+      : fd_(fd), out_(fd, RESPONSE_BUFFER_SIZE),
+        generator_(std::move(generator)), registry_(registry),
+        options_(options) {}
+
+  void serve() {
+    std::string pending;
+    char chunk[4096];
+    for (;;) {
+      size_t newline;
+      while ((newline = pending.find('\n')) != std::string::npos) {
+        handle(std::string_view(pending.data(), newline));
+        pending.erase(0, newline + 1);
+      }
+      if (pending.size() > MAX_REQUEST_LINE) {
+        reply_error("请求行过长");
+        out_.flush();
+        return;
+      }
+      out_.flush();
+      ssize_t ret = read(fd_, chunk, sizeof(chunk));
+      if (ret < 0 && errno == EINTR) {
+        continue;
+      }
+      if (ret <= 0) {
+        return; // 对端关闭或出错
+      }
+      pending.append(chunk, static_cast<size_t>(ret));
+    }
+  }
+
+private:
+  int fd_;
+  OutputWriter out_;
+  Generator generator_;
+  CharsetRegistry &registry_;
+  const ServerOptions &options_;
+  std::map<const Charset *, std::unique_ptr<CharsetSampler>> samplers_;
+  std::vector<char> payload_;
+
+  void reply_error(const char *reason) {
+    out_.append("ERR ");
+    out_.append(reason, std::strlen(reason));
+    out_.append('\n');
+  }
+
+  void handle(std::string_view line) {
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    uint64_t length = 0;
+    uint64_t count = 0;
+    std::string charset_id = "default";
+    const char *p = line.data();
+    const char *end = line.data() + line.size();
+    auto skip_spaces = [&] {
+      while (p != end && *p == ' ') {
+        ++p;
+      }
+    };
+    skip_spaces();
+    auto parsed = std::from_chars(p, end, length);
+    if (parsed.ec != std::errc()) {
+      reply_error("格式应为 <length> <count> [charset]");
+      return;
+    }
+    p = parsed.ptr;
+    skip_spaces();
+    parsed = std::from_chars(p, end, count);
+    if (parsed.ec != std::errc()) {
+      reply_error("格式应为 <length> <count> [charset]");
+      return;
+    }
+    p = parsed.ptr;
+    skip_spaces();
+    if (p != end) {
+      const char *id_end = p;
+      while (id_end != end && *id_end != ' ') {
+        ++id_end;
+      }
+      charset_id.assign(p, id_end);
+      p = id_end;
+      skip_spaces();
+      if (p != end) {
+        reply_error("格式应为 <length> <count> [charset]");
+        return;
+      }
+    }
+
+    const Charset *charset = registry_.find(charset_id);
+    if (charset == nullptr) {
+      reply_error("未知字符集");
+      return;
+    }
+    // 用浮点数估算，避免超大 length * count 溢出
+    double max_bytes = static_cast<double>(count) *
+                       (static_cast<double>(length) * charset->max_width() + 1);
+    if (max_bytes > static_cast<double>(options_.max_response_bytes)) {
+      reply_error("应答超过大小上限");
+      return;
+    }
+
+    auto &sampler = samplers_[charset];
+    if (!sampler) {
+      sampler = std::make_unique<CharsetSampler>(*charset);
+    }
+    payload_.resize(static_cast<size_t>(max_bytes));
+    char *dest = payload_.data();
+    for (uint64_t i = 0; i < count; ++i) {
+      dest = sampler->write(dest, length, generator_);
+      *dest++ = '\n';
+    }
+    size_t size = static_cast<size_t>(dest - payload_.data());
+
+    char header[32];
+    auto header_end = std::to_chars(header + 3, header + sizeof(header) - 1,
+                                    static_cast<uint64_t>(size))
+                          .ptr;
+    std::memcpy(header, "OK ", 3);
+    *header_end++ = '\n';
+    out_.append(header, static_cast<size_t>(header_end - header));
+    out_.append(payload_.data(), size);
+    secure_wipe(payload_.data(), size);
+  }
+};
+
+template <typename Generator>
+void serve_connection(int fd, Generator generator, CharsetRegistry &registry,
+                      const ServerOptions &options) {
+  Connection<Generator> connection(fd, std::move(generator), registry,
+                                   options);
+  connection.serve();
+}
+
+} // namespace
+
+void run_token_server(const ServerOptions &options, Charset default_charset) {
+  sockaddr_un address = make_address(options.socket_path);
+  CharsetRegistry registry(std::move(default_charset));
+
+  int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listener < 0) {
+    throw std::runtime_error("创建套接字失败: " +
+                             std::string(std::strerror(errno)));
+  }
+  // 清理上次异常退出遗留的套接字文件：只删除无人监听的套接字，不碰普通文件
+  struct stat st {};
+  if (lstat(options.socket_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool in_use = probe >= 0 &&
+                  connect(probe, reinterpret_cast<sockaddr *>(&address),
+                          sizeof(address)) == 0;
+    if (probe >= 0) {
+      close(probe);
+    }
+    if (in_use) {
+      close(listener);
+      throw std::runtime_error("已有服务在监听 " + options.socket_path);
+    }
+    unlink(options.socket_path.c_str());
+  }
+  if (bind(listener, reinterpret_cast<sockaddr *>(&address),
+           sizeof(address)) < 0 ||
+      listen(listener, SOMAXCONN) < 0) {
+    int err = errno;
+    close(listener);
+    throw std::runtime_error("监听 " + options.socket_path +
+                             " 失败: " + std::strerror(err));
+  }
+
+  // 不设置 SA_RESTART：收到信号时 accept 返回 EINTR，主循环随之退出
+  struct sigaction action {};
+  action.sa_handler = request_stop;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+  std::signal(SIGPIPE, SIG_IGN);
+
+  struct Client {
+    int fd;
+    std::thread thread;
+    std::atomic<bool> done{false};
+  };
+  std::list<Client> clients;
+  auto reap = [&] {
+    for (auto it = clients.begin(); it != clients.end();) {
+      if (it->done.load()) {
+        it->thread.join();
+        close(it->fd);
+        it = clients.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  };
+
+  // 信号只交给主线程处理：工作线程继承屏蔽了 SIGINT / SIGTERM 的信号掩码
+  sigset_t blocked, previous;
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGINT);
+  sigaddset(&blocked, SIGTERM);
+
+  while (!stop_requested) {
+    int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      int err = errno;
+      close(listener);
+      unlink(options.socket_path.c_str());
+      throw std::runtime_error("accept 失败: " + std::string(std::strerror(err)));
+    }
+    reap();
+    if (clients.size() >= options.max_clients) {
+      static const char busy[] = "ERR 服务器繁忙\n";
+      ssize_t ignored = send(fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL);
+      (void)ignored;
+      close(fd);
+      continue;
+    }
+    clients.emplace_back();
+    Client &client = clients.back();
+    client.fd = fd;
+    pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+    client.thread = std::thread([&client, &registry, &options] {
+      try {
+        if (options.engine == EngineKind::chacha20) {
+          serve_connection(client.fd,
+                           ChaCha20Generator(options.reseed_interval),
+                           registry, options);
+        } else if (options.engine == EngineKind::rdrand ||
+                   options.engine == EngineKind::rdseed) {
+          serve_connection(client.fd,
+                           HardwareRandomGenerator(
+                               options.engine == EngineKind::rdrand
+                                   ? HardwareInstruction::rdrand
+                                   : HardwareInstruction::rdseed,
+                               options.mix_kernel, options.pool_size),
+                           registry, options);
+        } else {
+          serve_connection(client.fd, SystemRandomGenerator(options.pool_size),
+                           registry, options);
+        }
+      } catch (const std::exception &) {
+        // 对端关闭（OutputClosed）或 I/O 错误：只结束这个连接
+      }
+      // 先 shutdown 让对端立即看到 EOF；fd 由主线程在 join 之后关闭，
+      // 避免编号被复用后主线程误 shutdown 其他连接
+      shutdown(client.fd, SHUT_RDWR);
+      client.done.store(true);
+    });
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+  }
+
+  close(listener);
+  unlink(options.socket_path.c_str());
+  // 唤醒仍阻塞在 read 上的连接并等待它们结束
+  for (auto &client : clients) {
+    shutdown(client.fd, SHUT_RDWR);
+  }
+  for (auto &client : clients) {
+    client.thread.join();
+    close(client.fd);
+  }
+}
+
+void request_tokens(const std::string &socket_path, size_t length,
+                    uint64_t count, const std::string &charset_id,
+                    OutputWriter &out) {
+  sockaddr_un address = make_address(socket_path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    throw std::runtime_error("创建套接字失败: " +
+                             std::string(std::strerror(errno)));
+  }
+  struct FdCloser {
+    int fd;
+    ~FdCloser() { close(fd); }
+  } closer{fd};
+  if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) <
+      0) {
+    throw std::runtime_error("连接 " + socket_path +
+                             " 失败: " + std::strerror(errno));
+  }
+
+  std::string request = std::to_string(length) + " " + std::to_string(count) +
+                        " " + charset_id + "\n";
+  OutputWriter sender(fd, request.size());
+  sender.append(request);
+  sender.flush();
+
+  // 读取应答头，再按长度前缀把数据转发到 out
+  char buffer[64 * 1024];
+  size_t buffered = 0;
+  size_t header_end = std::string::npos;
+  while (header_end == std::string::npos) {
+    ssize_t ret = read(fd, buffer + buffered, sizeof(buffer) - buffered);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      throw std::runtime_error("服务端提前关闭连接");
+    }
+    buffered += static_cast<size_t>(ret);
+    const void *newline = std::memchr(buffer, '\n', buffered);
+    if (newline != nullptr) {
+      header_end = static_cast<size_t>(static_cast<const char *>(newline) -
+                                       buffer);
+    } else if (buffered == sizeof(buffer)) {
+      throw std::runtime_error("服务端应答头过长");
+    }
+  }
+  std::string header(buffer, header_end);
+  if (header.compare(0, 3, "OK ") != 0) {
+    throw std::runtime_error("服务端返回错误: " + header);
+  }
+  uint64_t remaining = 0;
+  auto parsed = std::from_chars(header.data() + 3,
+                                header.data() + header.size(), remaining);
+  if (parsed.ec != std::errc() || parsed.ptr != header.data() + header.size()) {
+    throw std::runtime_error("无法解析服务端应答: " + header);
+  }
+
+  size_t body = buffered - header_end - 1;
+  size_t n = static_cast<size_t>(std::min<uint64_t>(body, remaining));
+  out.append(buffer + header_end + 1, n);
+  remaining -= n;
+  while (remaining > 0) {
+    ssize_t ret = read(fd, buffer,
+                       static_cast<size_t>(
+                           std::min<uint64_t>(sizeof(buffer), remaining)));
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      throw std::runtime_error("服务端提前关闭连接");
+    }
+    out.append(buffer, static_cast<size_t>(ret));
+    remaining -= static_cast<uint64_t>(ret);
+  }
+  out.flush();
+}
+
+#endif // _WIN32
+
+} // namespace randomstr
@@ -0,0 +1,39 @@
+// 常驻令牌服务：通过 Unix 域套接字对外发放随机字符串
+//
+// 协议（文本行请求，长度前缀应答）：
+//   请求：<length> <count> [charset]\n
+//         charset 为 default（服务启动时由 -s / -c 指定的字符集）或以 '+'
+//         连接的内置字符集名（dn、en、zh、sp，如 dn+en），缺省为 default
+//   应答：OK <bytes>\n 后跟 bytes 字节的数据，每个字符串以 '\n' 结尾
+//         ERR <原因>\n 表示请求无效，连接保持可用
+// 一个连接上可以连续发送多个请求，按顺序应答。
+#ifndef TOKEN_SERVER_HPP
+#define TOKEN_SERVER_HPP
+
+#include "randomstr.hpp"
+
+namespace randomstr {
+
+struct ServerOptions {
+  std::string socket_path;
+  EngineKind engine = EngineKind::system;
+  size_t pool_size = SystemRandomGenerator::DEFAULT_POOL_SIZE;
+  uint64_t reseed_interval = ChaCha20Generator::DEFAULT_RESEED_INTERVAL;
+  bool mix_kernel = false; // rdrand / rdseed 引擎的输出再与内核熵异或
+  unsigned max_clients = 64;                     // 同时服务的连接数上限
+  uint64_t max_response_bytes = 10 * 1024 * 1024; // 单个应答的数据上限
+};
+
+// 在 options.socket_path 上监听并服务，直到收到 SIGINT / SIGTERM。字符集在
+// 首次使用时构建并常驻内存，每个连接持有独立的引擎与采样器。
+void run_token_server(const ServerOptions &options, Charset default_charset);
+
+// 客户端：发送一个请求，把应答数据写到 out；服务端返回 ERR 时抛出
+// std::runtime_error
+void request_tokens(const std::string &socket_path, size_t length,
+                    uint64_t count, const std::string &charset_id,
+                    OutputWriter &out);
+
+} // namespace randomstr
+
+#endif // TOKEN_SERVER_HPP
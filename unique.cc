@@ -0,0 +1,229 @@
+// --unique：令牌去重键的编码与分片开放寻址表
+#include "randomstr.hpp"
+
+#include <algorithm>
+
+#include "charSet.hpp"
+
+namespace randomstr {
+
+namespace {
+
+// 装载因子超过 7/10 时槽位翻倍
+constexpr uint64_t MAX_LOAD_NUM = 7;
+constexpr uint64_t MAX_LOAD_DEN = 10;
+constexpr size_t MIN_SLOTS = 64;
+
+uint64_t pack_utf8(std::string_view ch) {
+  uint64_t packed = ch.size();
+  for (size_t k = 0; k < ch.size(); ++k) {
+    packed |= uint64_t{static_cast<unsigned char>(ch[k])} << (56 - 8 * k);
+  }
+  return packed;
+}
+
+size_t slots_for(uint64_t keys) {
+  size_t slots = MIN_SLOTS;
+  while (slots * MAX_LOAD_NUM < keys * MAX_LOAD_DEN) {
+    slots *= 2;
+  }
+  return slots;
+}
+
+} // namespace
+
+TokenKeyEncoder::TokenKeyEncoder(const Charset &charset, size_t length)
+    : charset_(&charset), length_(length) {
+  while ((size_t{1} << bits_) < charset.size()) {
+    ++bits_;
+  }
+  key_bytes_ = std::max<size_t>((length * bits_ + 7) / 8, 1);
+  if (charset.width() == 1) {
+    byte_index_.assign(256, -1);
+    for (size_t i = 0; i < charset.size(); ++i) {
+      byte_index_[static_cast<unsigned char>(charset.at(i)[0])] =
+          static_cast<int32_t>(i);
+    }
+  } else {
+    index_.reserve(charset.size());
+    for (size_t i = 0; i < charset.size(); ++i) {
+      index_.emplace_back(pack_utf8(charset.at(i)), static_cast<uint32_t>(i));
+    }
+    std::sort(index_.begin(), index_.end());
+  }
+}
+
+TokenKeyEncoder::TokenKeyEncoder(size_t max_bytes)
+    : key_bytes_(std::max<size_t>(max_bytes, 1)) {}
+
+bool TokenKeyEncoder::encode(std::string_view token, unsigned char *key) const {
+  std::memset(key, 0, key_bytes_);
+  if (charset_ == nullptr) {
+    if (token.size() > key_bytes_) {
+      return false;
+    }
+    std::memcpy(key, token.data(), token.size());
+    return true;
+  }
+
+  // 索引按位依次拼接，低位在前
+  uint64_t acc = 0;
+  unsigned acc_bits = 0;
+  size_t out = 0;
+  size_t chars = 0;
+  size_t pos = 0;
+  while (pos < token.size()) {
+    uint32_t index;
+    if (!byte_index_.empty()) {
+      int32_t i = byte_index_[static_cast<unsigned char>(token[pos])];
+      if (i < 0) {
+        return false;
+      }
+      index = static_cast<uint32_t>(i);
+      ++pos;
+    } else {
+      size_t n = charset_->width() != 0
+                     ? charset_->width()
+                     : utf8_char_length(static_cast<unsigned char>(token[pos]));
+      if (pos + n > token.size()) {
+        return false;
+      }
+      uint64_t packed = pack_utf8(token.substr(pos, n));
+      auto it = std::lower_bound(
+          index_.begin(), index_.end(), std::make_pair(packed, uint32_t{0}));
+      if (it == index_.end() || it->first != packed) {
+        return false;
+      }
+      index = it->second;
+      pos += n;
+    }
+    if (++chars > length_) {
+      return false;
+    }
+    acc |= uint64_t{index} << acc_bits;
+    acc_bits += bits_;
+    while (acc_bits >= 8) {
+      key[out++] = static_cast<unsigned char>(acc);
+      acc >>= 8;
+      acc_bits -= 8;
+    }
+  }
+  if (chars != length_) {
+    return false;
+  }
+  if (acc_bits > 0) {
+    key[out] = static_cast<unsigned char>(acc);
+  }
+  return true;
+}
+
+UniqueTable::UniqueTable(size_t key_bytes, uint64_t expected, unsigned shards)
+    : key_bytes_(key_bytes) {
+  while ((1u << shard_bits_) < shards) {
+    ++shard_bits_;
+  }
+  size_t count = size_t{1} << shard_bits_;
+  // 哈希均匀时各分片的键数相差无几，多留 1/16 余量避免早期扩容
+  uint64_t per_shard = expected / count + expected / count / 16 + 1;
+  shards_.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    auto shard = std::make_unique<Shard>();
+    shard->slots.assign(slots_for(per_shard), 0);
+    shard->arena.reserve(per_shard * key_bytes_);
+    shards_.push_back(std::move(shard));
+  }
+}
+
+UniqueTable::~UniqueTable() {
+  for (auto &shard : shards_) {
+    secure_wipe(shard->arena.data(), shard->arena.size());
+  }
+}
+
+uint64_t UniqueTable::hash(const unsigned char *key) const {
+  uint64_t h = key_bytes_ * 0x9E3779B97F4A7C15ULL;
+  for (size_t i = 0; i < key_bytes_; i += 8) {
+    uint64_t word = 0;
+    std::memcpy(&word, key + i, std::min<size_t>(8, key_bytes_ - i));
+    h = (h ^ word) * 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 31;
+  }
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  return h;
+}
+
+void UniqueTable::grow(Shard &shard) {
+  std::vector<uint64_t> slots(shard.slots.size() * 2, 0);
+  size_t mask = slots.size() - 1;
+  for (uint64_t slot : shard.slots) {
+    if (slot == 0) {
+      continue;
+    }
+    uint64_t index = (slot & 0xFFFFFFFF) - 1;
+    size_t pos = hash(shard.arena.data() + index * key_bytes_) & mask;
+    while (slots[pos] != 0) {
+      pos = (pos + 1) & mask;
+    }
+    slots[pos] = slot;
+  }
+  shard.slots.swap(slots);
+}
+
+bool UniqueTable::insert(const unsigned char *key) {
+  uint64_t h = hash(key);
+  Shard &shard = *shards_[shard_bits_ == 0 ? 0 : h >> (64 - shard_bits_)];
+  // 标签取紧接在分片位之下的 32 位：同一分片内的标签不再共享高位，分片
+  // 再多也保留完整的 32 位区分度
+  uint64_t tag = (h << shard_bits_) >> 32;
+
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  size_t mask = shard.slots.size() - 1;
+  size_t pos = h & mask;
+  for (uint64_t slot; (slot = shard.slots[pos]) != 0; pos = (pos + 1) & mask) {
+    if ((slot >> 32) == tag &&
+        std::memcmp(shard.arena.data() + ((slot & 0xFFFFFFFF) - 1) * key_bytes_,
+                    key, key_bytes_) == 0) {
+      duplicates_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+  }
+  if (shard.used >= 0xFFFFFFFF) {
+    throw std::length_error("去重表分片已满");
+  }
+  if (shard.arena.size() + key_bytes_ > shard.arena.capacity()) {
+    // 自行扩容，以便擦除旧内存中的键
+    std::vector<unsigned char> arena;
+    arena.reserve(std::max(shard.arena.capacity() * 2, key_bytes_ * 1024));
+    arena.assign(shard.arena.begin(), shard.arena.end());
+    secure_wipe(shard.arena.data(), shard.arena.size());
+    shard.arena.swap(arena);
+  }
+  shard.arena.insert(shard.arena.end(), key, key + key_bytes_);
+  shard.slots[pos] = tag << 32 | ++shard.used;
+  if (shard.used * MAX_LOAD_DEN > shard.slots.size() * MAX_LOAD_NUM) {
+    grow(shard);
+  }
+  return true;
+}
+
+uint64_t UniqueTable::size() const {
+  uint64_t total = 0;
+  for (const auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    total += shard->used;
+  }
+  return total;
+}
+
+uint64_t UniqueTable::memory_bytes() const {
+  uint64_t total = 0;
+  for (const auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    total += shard->slots.size() * sizeof(uint64_t) + shard->arena.capacity();
+  }
+  return total;
+}
+
+} // namespace randomstr